@@ -0,0 +1,186 @@
+#include "simulator.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifndef DUNGEON_INSTRUMENT
+#error "the benchmark reads lock timings; build it with -DDUNGEON_INSTRUMENT"
+#endif
+
+// Scheduler throughput benchmark: zero-length dungeons in virtual time, so every party is pure matching,
+// assignment and completion bookkeeping. Sweeps fleet sizes and initial pool sizes and prints one CSV row (or
+// JSON object per line) per run, each run a Simulation of its own, so results can be diffed between versions.
+// Each row also counts the heap allocations made by the run, its setup included, and after its warm-up, per party.
+
+// Allocation counter: every global operator new in the process counts, and those made once a run has completed
+// its warm-up runs (by then every pass-sized buffer and per-thread shard is at its high water mark) count against
+// the steady state, which should make none
+atomic<uint64_t> allocations{0}, steadyAllocations{0};
+atomic<uint64_t> warmupRuns{numeric_limits<uint64_t>::max()};
+
+void countAllocation() {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (runsEnded.load(memory_order_relaxed) >= warmupRuns.load(memory_order_relaxed))
+        steadyAllocations.fetch_add(1, memory_order_relaxed);
+}
+
+// Out of line, so the compiler cannot pair the malloc inside with a free it sees in some inlined delete
+[[gnu::noinline]] void *operator new(size_t size) {
+    countAllocation();
+    if (void *memory = malloc(max<size_t>(size, 1))) return memory;
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new(size_t size, align_val_t alignment) {
+    countAllocation();
+    size_t align = (size_t) alignment;
+    if (void *memory = aligned_alloc(align, (max<size_t>(size, 1) + align - 1) / align * align)) return memory;
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *memory) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void *memory, size_t) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void *memory, align_val_t) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void *memory, size_t, align_val_t) noexcept { free(memory); }
+
+struct BenchResult {
+    int instances;
+    int parties;
+    int repeat;
+    double wallSeconds;
+    uint64_t formed;
+    uint64_t passes;
+    uint64_t allocations, steadyAllocations; // during the run, and past its warm-up
+    uint64_t steadyParties;                  // parties completed past the warm-up
+    HistogramSummary latencies, waits, holds; // lock waits and holds over every lock site
+};
+
+// Run one point into result; false with error set if prepareSimulation rejected it
+bool benchPoint(const SimulationConfig &config, int fleet, int parties, int repeat, BenchResult &result,
+                string &error) {
+    Simulation sim(config); // no classes configured, so prepareSimulation makes the default one for this fleet
+    const PartyKind &kind = sim.partyKinds.back();
+
+    // Warm up on a fleet's worth of runs, or half the pool when that is smaller. runsEnded counts over every
+    // simulation in the process, so the point's runs are those past the count it starts at.
+    uint64_t warmup = min<uint64_t>(fleet, parties / 2);
+    uint64_t allocated = allocations.load(), ended = runsEnded.load();
+    steadyAllocations = 0;
+    warmupRuns = ended + warmup;
+    int tanks = parties * kind.need[Tank], healers = parties * kind.need[Healer], dps = parties * kind.need[Dps];
+    double wallSeconds = sim.runPoint(fleet, tanks, healers, dps, error);
+    warmupRuns = numeric_limits<uint64_t>::max();
+    if (wallSeconds < 0) return false;
+    uint64_t runs = runsEnded.load() - ended;
+    result = {fleet, parties, repeat, wallSeconds, 0, 0, allocations.load() - allocated,
+              steadyAllocations.load(), runs - min(runs, warmup), {}, {}, {}};
+
+    lock_guard<mutex> lock(sim.metrics.m);
+    for (auto &shard: sim.metrics.shards) {
+        result.latencies.add(shard->assignLatencyNs);
+        for (int site = 0; site < kLockSites; ++site) {
+            result.waits.add(shard->lockWaitNs[site]);
+            result.holds.add(shard->lockHoldNs[site]);
+        }
+        result.formed += shard->partiesFormed.load(memory_order_relaxed);
+    }
+    result.passes = result.latencies.total;
+    return true;
+}
+
+void printResult(const SimulationConfig &config, const BenchResult &result, bool json) {
+    double rate = result.wallSeconds > 0 ? result.formed / result.wallSeconds : 0;
+    double allocsPerParty = result.steadyParties > 0 ? (double) result.steadyAllocations / result.steadyParties : 0;
+    if (json) {
+        cout << "{\"instances\": " << result.instances << ", \"parties\": " << result.parties << ", \"repeat\": "
+                << result.repeat << ", \"match\": \"" << config.matchPolicy << "\", \"select\": \""
+                << config.selectPolicy << "\", \"wall_s\": " << result.wallSeconds << ", \"parties_formed\": "
+                << result.formed << ", \"parties_per_s\": " << rate << ", \"passes\": " << result.passes
+                << ", \"assign_p50_ns\": " << result.latencies.percentile(0.5)
+                << ", \"assign_p99_ns\": " << result.latencies.percentile(0.99)
+                << ", \"assign_max_ns\": " << result.latencies.maxValue
+                << ", \"lock_wait_p50_ns\": " << result.waits.percentile(0.5)
+                << ", \"lock_wait_p99_ns\": " << result.waits.percentile(0.99)
+                << ", \"lock_wait_max_ns\": " << result.waits.maxValue
+                << ", \"lock_hold_p50_ns\": " << result.holds.percentile(0.5)
+                << ", \"lock_hold_p99_ns\": " << result.holds.percentile(0.99)
+                << ", \"lock_hold_max_ns\": " << result.holds.maxValue << ", \"allocs\": " << result.allocations
+                << ", \"steady_allocs\": " << result.steadyAllocations << ", \"steady_parties\": "
+                << result.steadyParties << ", \"steady_allocs_per_party\": " << allocsPerParty << "}\n";
+        return;
+    }
+    cout << result.instances << "," << result.parties << "," << result.repeat << "," << config.matchPolicy << ","
+            << config.selectPolicy << "," << result.wallSeconds << "," << result.formed << "," << rate << ","
+            << result.passes << "," << result.latencies.percentile(0.5) << "," << result.latencies.percentile(0.99)
+            << "," << result.latencies.maxValue << "," << result.waits.percentile(0.5) << ","
+            << result.waits.percentile(0.99) << "," << result.waits.maxValue << "," << result.holds.percentile(0.5)
+            << "," << result.holds.percentile(0.99) << "," << result.holds.maxValue << "," << result.allocations << ","
+            << result.steadyAllocations << "," << result.steadyParties << "," << allocsPerParty << "\n";
+}
+
+int main(int argc, char *argv[]) {
+    vector<int> fleetSizes = {1, 10, 100, 1000, 10000, 100000};
+    vector<int> poolSizes = {1000, 100000}; // parties' worth of players queued at time 0
+    int repeats = 3;
+    bool json = false;
+    SimulationConfig config;
+
+    vector<string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        bool ok = true;
+        if (arg == "--instances" && hasValue) ok = parseList(args[++i], fleetSizes, 1);
+        else if (arg == "--parties" && hasValue) ok = parseList(args[++i], poolSizes, 1);
+        else if (arg == "--repeat" && hasValue) ok = (repeats = atoi(args[++i].c_str())) > 0;
+        else if (arg == "--format" && hasValue && (args[i + 1] == "csv" || args[i + 1] == "json"))
+            json = args[++i] == "json";
+        else if (arg == "--match" && hasValue &&
+                 (args[i + 1] == "fifo" || args[i + 1] == "lwf" || args[i + 1] == "skill"))
+            config.matchPolicy = args[++i];
+        else if (arg == "--select" && hasValue &&
+                 (args[i + 1] == "first" || args[i + 1] == "round-robin" || args[i + 1] == "least-used"))
+            config.selectPolicy = args[++i];
+        else ok = false;
+        if (!ok) {
+            cerr << "Usage: " << argv[0] << " [--instances N,N,...] [--parties N,N,...] [--repeat R]\n"
+                    << "       [--format csv|json] [--match fifo|lwf|skill] [--select first|round-robin|least-used]\n";
+            return 1;
+        }
+    }
+    const PartyKind &kind = config.partyKinds.back();
+    int maxParties = kMaxRoleCount / *max_element(kind.need, kind.need + kRoleCount);
+    for (int parties: poolSizes) {
+        if (parties > maxParties) {
+            cerr << "--parties is limited to " << maxParties << " by the role pool\n";
+            return 1;
+        }
+    }
+
+    config.backend = Backend::Virtual;
+    config.quiet = true;
+    config.metricsEnabled = true;
+    config.t1 = config.t2 = 0;
+    config.masterSeed = 1;
+    config.skillBands = config.matchPolicy == "fifo" ? 1 : 4;
+
+    if (!json)
+        cout << "instances,parties,repeat,match,select,wall_s,parties_formed,parties_per_s,passes,assign_p50_ns,"
+                "assign_p99_ns,assign_max_ns,lock_wait_p50_ns,lock_wait_p99_ns,lock_wait_max_ns,lock_hold_p50_ns,"
+                "lock_hold_p99_ns,lock_hold_max_ns,allocs,steady_allocs,steady_parties,steady_allocs_per_party\n";
+    for (int fleet: fleetSizes) {
+        for (int parties: poolSizes) {
+            for (int repeat = 0; repeat < repeats; ++repeat) {
+                BenchResult result;
+                string error;
+                if (!benchPoint(config, fleet, parties, repeat, result, error)) {
+                    cerr << "point instances=" << fleet << " parties=" << parties << " repeat=" << repeat
+                            << " failed: " << error << "\n";
+                    return 1;
+                }
+                printResult(config, result, json);
+            }
+        }
+    }
+    return 0;
+}
@@ -1,240 +1,470 @@
-#include <iostream>
-#include <thread>
-#include <mutex>
-#include <vector>
-#include <condition_variable>
-#include <chrono>
-#include <random>
-#include <atomic>
-#include<algorithm>
-using namespace std;
+#include "simulator.h"
 
-// Player pool
-int tanks, healers, dps;
-int t1, t2; // dungeon run time bounds
-int partyNum = 1;
+#include <map>
 
-atomic<bool> stopFlag{false};
+bool partyKindsConfigured = false;
+bool seedGiven = false;
+string recordPath; // --record: event trace to write
+bool estimate = false; // --estimate: report the expected outcome instead of running
 
-mutex globalMutex;
-condition_variable cv_scheduler;
-
-struct Instance {
-    int id;
-    bool hasParty = false;
-    bool running = false;
-    int partiesServed = 0;
-    int totalTime = 0;
-
-    int currentTimeElapsed = 0;
-    int currDungeonDuration = 0;
-    condition_variable cv;
-    thread worker;
-
-    Instance(int id_) : id(id_) {
-    }
-
-    Instance(const Instance &) = delete;
-
-    Instance &operator=(const Instance &) = delete;
-
-    Instance(Instance &&) = delete;
-
-    Instance &operator=(Instance &&) = delete;
+// Integer run parameter: where it is stored and its largest accepted value
+struct IntOption {
+    int *value;
+    int max;
 };
 
-vector<shared_ptr<Instance> > instances;
-
-// Random run time between t1 and t2
-int getRandomTime() {
-    static random_device rd;
-    static mt19937 gen(rd());
-    uniform_int_distribution<> dist(t1, t2);
-    return dist(gen);
+bool parseIntValue(const string &text, int max, int &out) {
+    char *end = nullptr;
+    long long value = strtoll(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || value < 0 || value > max) return false;
+    out = (int) value;
+    return true;
 }
 
-// Thread function for each dungeon instance
-void instanceThread(shared_ptr<Instance> instance) {
-    unique_lock<mutex> lock(globalMutex);
-    while (!stopFlag) {
-        instance->cv.wait(lock, [&]() {
-            return instance->hasParty || stopFlag;
-        });
-
-        if (stopFlag) break;
-
-        int duration = getRandomTime();
-        instance->running = true;
-        instance->currDungeonDuration = duration;
-
-        cout << "[Instance " << instance->id << "] Running dungeon for " << duration << " seconds.\n";
-
-        lock.unlock();
-        this_thread::sleep_for(chrono::seconds(1));
-        instance->currentTimeElapsed++;
-        for (int i = 1; i < duration; ++i) {
-            this_thread::sleep_for(chrono::seconds(1));
-            instance->currentTimeElapsed++;
-        }
-        lock.lock();
-
-        instance->running = false;
-        instance->hasParty = false;
-        instance->partiesServed++;
-        instance->totalTime += duration;
-        instance->currentTimeElapsed = 0;
-
-        cout << "[Instance " << instance->id << "] Dungeon completed.\n";
+bool parsePositiveValue(const string &text, double &out) {
+    char *end = nullptr;
+    double value = strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || !(value > 0) || !isfinite(value)) return false;
+    out = value;
+    return true;
+}
 
-        cv_scheduler.notify_all();
+bool parseOptions(Simulation &sim, const vector<string> &args, map<string, IntOption> &intOptions, string &error);
+
+// Empirical run times: "SECONDS WEIGHT" per line, "#" starts a comment
+bool loadHistogram(const string &path, DurationDistribution &duration) {
+    ifstream file(path);
+    vector<double> weights;
+    string line;
+    while (getline(file, line)) {
+        istringstream fields(line.substr(0, line.find('#')));
+        int seconds;
+        double weight;
+        if (!(fields >> seconds >> weight) || seconds < 0 || weight <= 0) continue;
+        duration.seconds.push_back(seconds);
+        weights.push_back(weight);
     }
+    duration.bins = discrete_distribution<size_t>(weights.begin(), weights.end());
+    return !weights.empty();
 }
 
-// Dedicated scheduler thread: checks for party + instance, assigns work
-
-void schedulerThread() {
-    unique_lock<mutex> lock(globalMutex);
-    while (true) {
-        cv_scheduler.wait(lock, [&]() {
-            // cout << "[Scheduler] Woke up.\n";
-
-            return (tanks >= 1 && healers >= 1 && dps >= 3) || stopFlag || any_of(
-                       instances.begin(), instances.end(), [](auto &inst) {
-                           return !inst->hasParty && !inst->running;
-                       }) || instances.empty();
-        });
-
-        if (stopFlag) break;
-
-        bool partyAssigned = false;
-
-        // Try to assign party to any free instance
-        for (auto &instance: instances) {
-            if (!instance->hasParty && !instance->running &&
-                tanks >= 1 && healers >= 1 && dps >= 3) {
-                // cout << "[Scheduler] Assigning party "<< partyNum << " to instance " << instance->id << endl;
-
-                tanks--;
-                healers--;
-                dps -= 3;
-                partyNum++;
+// NAME:COUNT:CAPACITY:uniform,MIN,MAX | normal,MEAN,SD | lognormal,MU,SIGMA | empirical,FILE
+bool parseInstanceClass(const string &spec, InstanceClass &out) {
+    vector<string> fields;
+    istringstream parts(spec);
+    for (string field; getline(parts, field, ':');) fields.push_back(field);
+    if (fields.size() != 4 || fields[0].empty() || !parseIntValue(fields[1], numeric_limits<int>::max(), out.count)
+        || !parseIntValue(fields[2], numeric_limits<int>::max(), out.capacity) || out.capacity == 0)
+        return false;
+    out.name = fields[0];
+
+    string shape = fields[3].substr(0, fields[3].find(','));
+    string params = fields[3].find(',') == string::npos ? "" : fields[3].substr(fields[3].find(',') + 1);
+    DurationDistribution &duration = out.duration;
+    if (shape == "empirical") {
+        duration.shape = DurationDistribution::Empirical;
+        return loadHistogram(params, duration);
+    }
+    char comma;
+    istringstream values(params);
+    if (!(values >> duration.a >> comma >> duration.b) || comma != ',' || !(values >> ws).eof()) return false;
+    if (shape == "uniform") {
+        // Whole seconds only: the draw is over integers, so 1.9 would quietly become 1
+        duration.shape = DurationDistribution::Uniform;
+        return duration.a >= 0 && duration.a <= duration.b && duration.b <= numeric_limits<int>::max()
+               && duration.a == floor(duration.a) && duration.b == floor(duration.b);
+    }
+    // The spread must be positive: normal_distribution and lognormal_distribution require it
+    duration.shape = shape == "normal" ? DurationDistribution::Normal : DurationDistribution::Lognormal;
+    return (shape == "normal" || shape == "lognormal") && duration.b > 0;
+}
 
-                instance->hasParty = true;
-                instance->cv.notify_one();
+// Config file: one "name = value" per line mirroring the long flags, "#" starts a comment, "name = true" for
+// switches. Expanded in place so flags after --config override it.
+bool parseConfigFile(Simulation &sim, const string &path, map<string, IntOption> &intOptions, string &error) {
+    ifstream file(path);
+    if (!file) {
+        error = "cannot open config file " + path;
+        return false;
+    }
+    vector<string> args;
+    string line;
+    while (getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        replace(line.begin(), line.end(), '=', ' ');
+        istringstream fields(line);
+        string name, value;
+        if (!(fields >> name)) continue;
+        fields >> value;
+        if (value == "false") continue;
+        args.push_back("--" + name);
+        if (!value.empty() && value != "true") args.push_back(value);
+    }
+    return parseOptions(sim, args, intOptions, error);
+}
 
-                partyAssigned = true;
-                break; // assign one party per scheduler cycle
+bool parseOptions(Simulation &sim, const vector<string> &args, map<string, IntOption> &intOptions, string &error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg.size() > 2 && intOptions.count(arg.substr(2))) {
+            IntOption &option = intOptions[arg.substr(2)];
+            if (!hasValue || !parseIntValue(args[++i], option.max, *option.value)) {
+                error = arg + " expects a number from 0 to " + to_string(option.max);
+                return false;
             }
-        }
-
-        // Check stop condition
-        bool hasMorePlayers = (tanks >= 1 && healers >= 1 && dps >= 3);
-        // cout << "Tanks: " << tanks << ", Healers: " << healers << ", DPS: " << dps << endl;
-        // cout << "[Scheduler] More players: " << (hasMorePlayers ? "yes" : "no") << endl;
-        bool anyRunning = false;
-        for (auto &inst: instances) {
-            if (inst->hasParty || inst->running) {
-                // cout << "[Scheduler] Instance " << inst->id << " has party or running.\n";
-                anyRunning = true;
-                break;
+        } else if (arg == "--pool") {
+            sim.backend = Backend::Pool;
+        } else if (arg == "--coroutines") {
+            sim.backend = Backend::Coroutine;
+        } else if (arg == "--workers" && hasValue) {
+            // Only the worker count; the backend is chosen by --pool or --coroutines whatever the flag order
+            if (!parseIntValue(args[++i], kMaxPoolWorkers, sim.poolWorkers) || sim.poolWorkers == 0) {
+                error = "--workers expects a worker count from 1 to " + to_string(kMaxPoolWorkers);
+                return false;
+            }
+        } else if (arg == "--virtual-time") {
+            sim.backend = Backend::Virtual;
+        } else if (arg == "--time-scale" && hasValue) {
+            if (!parsePositiveValue(args[++i], sim.timeScale)) {
+                error = "--time-scale expects a positive number of simulated seconds per wall second";
+                return false;
+            }
+            sim.paced = true;
+        } else if (arg == "--arrival-rate" && hasValue) {
+            char comma1, comma2;
+            istringstream rates(args[++i]);
+            double *rate = sim.arrivals.rates;
+            if (!(rates >> rate[Tank] >> comma1 >> rate[Healer] >> comma2 >> rate[Dps]) || comma1 != ',' ||
+                comma2 != ',') {
+                error = "--arrival-rate expects TANKS,HEALERS,DPS players per second";
+                return false;
+            }
+        } else if (arg == "--arrival-trace" && hasValue) {
+            sim.arrivals.trace.open(args[++i]);
+            sim.arrivals.fromTrace = true;
+            if (!sim.arrivals.trace) {
+                error = "cannot open arrival trace " + args[i];
+                return false;
+            }
+        } else if (arg == "--duration" && hasValue) {
+            if (!parsePositiveValue(args[++i], sim.arrivals.arrivalLimit)) {
+                error = "--duration expects a positive number of seconds";
+                return false;
+            }
+        } else if (arg == "--match" && hasValue) {
+            sim.matchPolicy = args[++i];
+            if (sim.matchPolicy != "fifo" && sim.matchPolicy != "lwf" && sim.matchPolicy != "skill") {
+                error = "--match expects fifo, lwf or skill";
+                return false;
+            }
+        } else if (arg == "--select" && hasValue) {
+            sim.selectPolicy = args[++i];
+            if (sim.selectPolicy != "first" && sim.selectPolicy != "round-robin" && sim.selectPolicy != "least-used") {
+                error = "--select expects first, round-robin or least-used";
+                return false;
+            }
+        } else if (arg == "--regions" && hasValue) {
+            // N equal regions, or each region's relative share of arriving players
+            vector<int> weights;
+            istringstream items(args[++i]);
+            for (string item; getline(items, item, ',');) {
+                int weight;
+                if (!parseIntValue(item, kMaxRoleCount, weight) || weight == 0) weight = kMaxRoleCount + 1;
+                weights.push_back(weight);
             }
+            if (weights.size() == 1) weights.assign(min(weights[0], kMaxRegions + 1), 1);
+            if (weights.empty() || weights.size() > kMaxRegions ||
+                *max_element(weights.begin(), weights.end()) > kMaxRoleCount) {
+                error = "--regions expects a count up to " + to_string(kMaxRegions) + " or one weight per region";
+                return false;
+            }
+            sim.regions = (int) weights.size();
+            sim.regionWeightTotal = 0;
+            for (int region = 0; region < sim.regions; ++region)
+                sim.regionWeightTotal += sim.regionWeights[region] = weights[region];
+        } else if (arg == "--steal") {
+            sim.stealing = true;
+        } else if (arg == "--queue-cap" && hasValue) {
+            char comma1, comma2;
+            istringstream caps(args[++i]);
+            int *cap = sim.queueCap;
+            if (!(caps >> cap[Tank] >> comma1 >> cap[Healer] >> comma2 >> cap[Dps]) || comma1 != ',' ||
+                comma2 != ',' || !caps.eof() || *min_element(cap, cap + kRoleCount) < 0 ||
+                *max_element(cap, cap + kRoleCount) > kMaxRoleCount) {
+                error = "--queue-cap expects TANKS,HEALERS,DPS waiting players, each up to " + to_string(kMaxRoleCount);
+                return false;
+            }
+        } else if (arg == "--admission" && hasValue && (args[i + 1] == "shed" || args[i + 1] == "block")) {
+            sim.admissionBlocks = args[++i] == "block";
+        } else if (arg == "--autoscale" && hasValue) {
+            string range = args[++i];
+            size_t colon = range.find(':');
+            if (colon == string::npos || !parseIntValue(range.substr(0, colon), kMaxRoleCount, sim.autoscaleMin) ||
+                !parseIntValue(range.substr(colon + 1), kMaxRoleCount, sim.autoscaleMax) || sim.autoscaleMin < 1 ||
+                sim.autoscaleMax < sim.autoscaleMin) {
+                error = "--autoscale expects MIN:MAX instances, 1 <= MIN <= MAX <= " + to_string(kMaxRoleCount);
+                return false;
+            }
+            sim.metricsEnabled = true; // decisions read the party wait histograms
+        } else if (arg == "--wait-slo" && hasValue) {
+            if (!parsePositiveValue(args[++i], sim.waitSlo)) {
+                error = "--wait-slo expects a positive number of seconds";
+                return false;
+            }
+        } else if (arg == "--party" && hasValue) {
+            // NAME:TANKS,HEALERS,DPS; the first one replaces the default dungeon
+            string spec = args[++i], name = spec.substr(0, spec.find(':'));
+            int need[kRoleCount];
+            char comma1, comma2;
+            istringstream counts(spec.find(':') == string::npos ? "" : spec.substr(spec.find(':') + 1));
+            if (name.empty() || !(counts >> need[Tank] >> comma1 >> need[Healer] >> comma2 >> need[Dps]) ||
+                comma1 != ',' || comma2 != ',' || *min_element(need, need + kRoleCount) < 0 ||
+                *max_element(need, need + kRoleCount) > kMaxPartyNeed || need[Tank] + need[Healer] + need[Dps] == 0) {
+                error = "--party expects NAME:TANKS,HEALERS,DPS with counts up to " + to_string(kMaxPartyNeed);
+                return false;
+            }
+            if (!partyKindsConfigured) sim.partyKinds.clear();
+            partyKindsConfigured = true;
+            if (sim.partyKinds.size() == kMaxPartyKinds) {
+                error = "at most " + to_string(kMaxPartyKinds) + " party kinds";
+                return false;
+            }
+            sim.partyKinds.push_back(makePartyKind(name, need[Tank], need[Healer], need[Dps]));
+        } else if (arg == "--class" && hasValue) {
+            InstanceClass instanceClass;
+            if (!parseInstanceClass(args[++i], instanceClass)) {
+                error = "--class expects NAME:COUNT:CAPACITY:uniform,MIN,MAX|normal,MEAN,SD|lognormal,MU,SIGMA|"
+                        "empirical,FILE with whole-second MIN <= MAX and positive SD and SIGMA";
+                return false;
+            }
+            if (sim.instanceClasses.size() == kMaxInstanceClasses) {
+                error = "at most " + to_string(kMaxInstanceClasses) + " instance classes";
+                return false;
+            }
+            sim.instanceClasses.push_back(move(instanceClass));
+        } else if (arg == "--seed" && hasValue) {
+            char *end = nullptr;
+            sim.masterSeed = strtoull(args[++i].c_str(), &end, 10);
+            seedGiven = true;
+            if (args[i].empty() || *end != '\0') {
+                error = "--seed expects an unsigned integer";
+                return false;
+            }
+        } else if (arg == "--record" && hasValue) {
+            recordPath = args[++i];
+        } else if (arg == "--replay" && hasValue) {
+            if (!sim.replay.load(args[++i], error)) return false;
+            sim.backend = Backend::Virtual;
+        } else if (arg == "--metrics") {
+            sim.metricsEnabled = true;
+        } else if (arg == "--estimate") {
+            estimate = true;
+        } else if (arg == "--quiet") {
+            sim.quiet = true;
+        } else if (arg == "--status" && hasValue) {
+            string status = args[++i];
+            if (status != "summary" && status != "instances") {
+                error = "--status expects summary or instances";
+                return false;
+            }
+            sim.statusSummary = status == "summary";
+        } else if (arg == "--metrics-port" && hasValue) {
+            if (!parseIntValue(args[++i], 65535, sim.exporter.port) || sim.exporter.port == 0) {
+                error = "--metrics-port expects a port from 1 to 65535";
+                return false;
+            }
+            sim.metricsEnabled = true;
+        } else if (arg == "--log-file" && hasValue) {
+            sim.logSink.out = fopen(args[++i].c_str(), "w");
+            if (!sim.logSink.out) {
+                error = "cannot open log file " + args[i];
+                return false;
+            }
+        } else if (arg == "--log-policy" && hasValue && (args[i + 1] == "drop" || args[i + 1] == "block")) {
+            sim.logSink.policy = args[++i] == "drop" ? LogPolicy::Drop : LogPolicy::Block;
+        } else if (arg == "--log-capacity" && hasValue) {
+            int capacity;
+            if (!parseIntValue(args[++i], kMaxLogCapacity, capacity) || capacity == 0) {
+                error = "--log-capacity expects a record count from 1 to " + to_string(kMaxLogCapacity);
+                return false;
+            }
+            sim.logCapacity = capacity;
+        } else if (arg == "--config" && hasValue) {
+            if (!parseConfigFile(sim, args[++i], intOptions, error)) return false;
+        } else {
+            error = "unrecognized option " + arg;
+            return false;
         }
+    }
+    return true;
+}
 
-        if (!hasMorePlayers && !anyRunning) {
-            stopFlag = true;
-            for (auto &inst: instances) inst->cv.notify_all();
-            break;
+int main(int argc, char *argv[]) {
+    Simulation sim;
+    int n = -1, tanks = -1, healers = -1, dps = -1, bands = -1;
+    map<string, IntOption> intOptions = {
+        {"instances", {&n, numeric_limits<int>::max()}},
+        {"tanks", {&tanks, kMaxRoleCount}},
+        {"healers", {&healers, kMaxRoleCount}},
+        {"dps", {&dps, kMaxRoleCount}},
+        {"t1", {&sim.t1, numeric_limits<int>::max()}},
+        {"t2", {&sim.t2, numeric_limits<int>::max()}},
+        {"skill-bands", {&bands, kMaxSkillBands}},
+    };
+    string error;
+    if (!parseOptions(sim, vector<string>(argv + 1, argv + argc), intOptions, error)) {
+        cout << error << "\n"
+                << "Usage: " << argv[0] << " [--instances N] [--tanks N] [--healers N] [--dps N] [--t1 S] [--t2 S]\n"
+                << "       [--config FILE] [--quiet] [--pool] [--coroutines] [--workers N] [--virtual-time]\n"
+                << "       [--time-scale R] [--log-file FILE] [--log-policy drop|block] [--log-capacity N]\n"
+                << "       [--metrics] [--status summary|instances] [--metrics-port PORT]\n"
+                << "       [--arrival-rate T,H,D | --arrival-trace FILE] [--duration S]\n"
+                << "       [--match fifo|lwf|skill] [--select first|round-robin|least-used] [--skill-bands B]\n"
+                << "       [--party NAME:T,H,D ...] [--class NAME:COUNT:CAPACITY:DISTRIBUTION ...] [--seed S]\n"
+                << "       [--record FILE] [--replay FILE] [--regions N|W,W,...] [--steal] [--estimate]\n"
+                << "       [--queue-cap T,H,D] [--admission shed|block] [--autoscale MIN:MAX] [--wait-slo S]\n"
+                << "Parameters not given are prompted for.\n";
+        return 1;
+    }
+    if (bands == 0) {
+        cout << "--skill-bands expects a number from 1 to " << kMaxSkillBands << "\n";
+        return 1;
+    }
+    if (estimate && (sim.arrivals.configured() || sim.replay.active() || !recordPath.empty())) {
+        cout << "--estimate covers the players queued at time 0; it takes no arrivals, replay or recording\n";
+        return 1;
+    }
+    if (sim.replay.active()) {
+        // The trace supplies the seed, the fleet size, the initial pool (as time-0 arrivals) and the run times;
+        // runs beyond the recorded ones draw uniformly over the recorded range
+        if (!seedGiven) sim.masterSeed = sim.replay.header->seed;
+        if (n < 0) n = (int) sim.replay.header->instanceCount;
+        if (tanks < 0) tanks = 0;
+        if (healers < 0) healers = 0;
+        if (dps < 0) dps = 0;
+        int shortest = numeric_limits<int>::max(), longest = 0;
+        for (size_t i = 0; i < sim.replay.count; ++i) {
+            if (sim.replay.records[i].event != TraceEvent::Start) continue;
+            shortest = min(shortest, (int) sim.replay.records[i].duration);
+            longest = max(longest, (int) sim.replay.records[i].duration);
         }
-
-        if (!partyAssigned) {
-            // Wait a short time to avoid tight loop if no free instance
-            lock.unlock();
-            this_thread::sleep_for(chrono::milliseconds(100));
-            lock.lock();
+        if (sim.t1 < 0) sim.t1 = shortest <= longest ? shortest : 0;
+        if (sim.t2 < 0) sim.t2 = max(sim.t1, longest);
+    } else if (!seedGiven) {
+        random_device rd;
+        sim.masterSeed = (uint64_t) rd() << 32 | rd();
+    }
+    // Declared classes fix the fleet and its run times
+    bool classesConfigured = !sim.instanceClasses.empty();
+    if (n < 0 && !classesConfigured) {
+        cout << "Enter number of dungeon instances: ";
+        while (!(cin >> n) || n < 0 || n > numeric_limits<int>::max() || cin.fail()) {
+            cout << "Invalid input. Enter a positive number of dungeon instances (max " << numeric_limits<int>::max()
+                    << "): ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
         }
     }
-}
-
-int main() {
-    int n;
-    cout << "Enter number of dungeon instances: ";
-    while (!(cin >> n) || n < 0 || n > numeric_limits<int>::max() || cin.fail()) {
-        cout << "Invalid input. Enter a positive number of dungeon instances (max " << numeric_limits<int>::max() <<
-                "): ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-    cout << "Enter number of tanks: ";
-    while (!(cin >> tanks) || tanks < 0 || tanks > numeric_limits<int>::max() || cin.fail()) {
-        cout << "Invalid input. Enter a positive number of tanks (max " << numeric_limits<int>::max() << "): ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-    cout << "Enter number of healers: ";
-    while (!(cin >> healers) || healers < 0 || healers > numeric_limits<int>::max() || cin.fail()) {
-        cout << "Invalid input. Enter a positive number of healers (max " << numeric_limits<int>::max() << "): ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-    cout << "Enter number of DPS: ";
-    while (!(cin >> dps) || dps < 0 || dps > numeric_limits<int>::max() || cin.fail()) {
-        cout << "Invalid input. Enter a positive number of DPS (max " << numeric_limits<int>::max() << "): ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-    cout << "Enter min dungeon time (t1): ";
-    while (!(cin >> t1) || t1 < 0 || t1 > numeric_limits<int>::max() || cin.fail()) {
-        cout << "Invalid input. Enter a positive min dungeon time (t1) (max " << numeric_limits<int>::max() << "): ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-    cout << "Enter max dungeon time (t2): ";
-    while (!(cin >> t2) || t2 < t1 || t2 > numeric_limits<int>::max() || cin.fail()) {
-        cout << "Invalid input. Enter a max dungeon time (t2) greater than or equal to t1 (max " << numeric_limits<
-            int>::max() << "): ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-
-    // Create instances and start threads
-    for (int i = 1; i <= n; ++i) {
-        auto inst = make_shared<Instance>(i);
-        inst->worker = thread(instanceThread, inst);
-        instances.push_back(inst);
-    }
-
-    // Start scheduler
-    thread scheduler(schedulerThread);
-
-    // Monitor loop (display status every second)
-    while (!stopFlag) {
-        {
-            // lock_guard<mutex> lock(globalMutex);
-            cout << "\n[Status]\n";
-            for (auto &inst: instances) {
-                cout << "Instance " << inst->id << ": " << (inst->running
-                                                                ? "active (" + to_string(inst->currentTimeElapsed) + "/"
-                                                                  + to_string(inst->currDungeonDuration) + ")"
-                                                                : "empty") << endl;
-            }
-            cout << "Leftover players: Tanks: " << tanks << ", Healers: " << healers << ", DPS: " << dps << endl;
+    if (tanks < 0) {
+        cout << "Enter number of tanks: ";
+        while (!(cin >> tanks) || tanks < 0 || tanks > kMaxRoleCount || cin.fail()) {
+            cout << "Invalid input. Enter a positive number of tanks (max " << kMaxRoleCount << "): ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+    if (healers < 0) {
+        cout << "Enter number of healers: ";
+        while (!(cin >> healers) || healers < 0 || healers > kMaxRoleCount || cin.fail()) {
+            cout << "Invalid input. Enter a positive number of healers (max " << kMaxRoleCount << "): ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+    if (dps < 0) {
+        cout << "Enter number of DPS: ";
+        while (!(cin >> dps) || dps < 0 || dps > kMaxRoleCount || cin.fail()) {
+            cout << "Invalid input. Enter a positive number of DPS (max " << kMaxRoleCount << "): ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+    if (sim.t1 < 0 && !classesConfigured) {
+        cout << "Enter min dungeon time (t1): ";
+        while (!(cin >> sim.t1) || sim.t1 < 0 || sim.t1 > numeric_limits<int>::max() || cin.fail()) {
+            cout << "Invalid input. Enter a positive min dungeon time (t1) (max " << numeric_limits<int>::max()
+                    << "): ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+    if (sim.t2 < 0 && !classesConfigured) {
+        cout << "Enter max dungeon time (t2): ";
+        while (!(cin >> sim.t2) || sim.t2 < sim.t1 || sim.t2 > numeric_limits<int>::max() || cin.fail()) {
+            cout << "Invalid input. Enter a max dungeon time (t2) greater than or equal to t1 (max "
+                    << numeric_limits<int>::max() << "): ";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+    if (sim.t2 < sim.t1) {
+        cout << "t2 (" << sim.t2 << ") must be greater than or equal to t1 (" << sim.t1 << ")\n";
+        return 1;
+    }
+    sim.skillBands = sim.matchPolicy == "fifo" ? 1 : bands > 0 ? bands : 4;
+    if (!sim.prepareSimulation(n, error)) {
+        cout << error << "\n";
+        return 1;
+    }
 
+    if (!recordPath.empty()) {
+        if (!sim.traceRecorder.open(recordPath, (uint32_t) n, sim.masterSeed)) {
+            cout << "cannot open event trace " << recordPath << "\n";
+            return 1;
         }
-        this_thread::sleep_for(chrono::milliseconds(1000));
+        sim.recording = true;
+    }
+
+    if (sim.exporter.port && !estimate && !sim.exporter.open(error)) {
+        cout << error << "\n";
+        return 1;
     }
 
-    scheduler.join();
-    for (auto &inst: instances)
-        if (inst->worker.joinable())
-            inst->worker.join();
+    if (tanks > 0) sim.addPlayers(Tank, tanks, 0);
+    if (healers > 0) sim.addPlayers(Healer, healers, 0);
+    if (dps > 0) sim.addPlayers(Dps, dps, 0);
+    if (estimate) {
+        sim.printEstimate(cout);
+        cout << "Seed: " << sim.masterSeed << "\n";
+        return 0;
+    }
+    sim.runSimulation();
+
+    if (sim.playersRejected > 0)
+        cerr << "[Arrivals] Rejected " << sim.playersRejected << " players (role pool full).\n";
+    if (sim.playersShed[Tank] + sim.playersShed[Healer] + sim.playersShed[Dps] > 0)
+        cerr << "[Arrivals] Shed " << sim.playersShed[Tank] << " tanks, " << sim.playersShed[Healer] << " healers and "
+                << sim.playersShed[Dps] << " DPS over the queue caps.\n";
+    if (sim.arrivalsHeld > 0)
+        cerr << "[Arrivals] Held back " << sim.arrivalsHeld << " arrivals at the queue caps for " << sim.heldSeconds
+                << " simulated seconds in all.\n";
+    if (sim.logSink.dropped > 0)
+        cerr << "[Log] Dropped " << sim.logSink.dropped << " records (ring full).\n";
 
     // Final summary
     cout << "\n=== Summary ===\n";
-    for (auto &inst: instances) {
-        cout << "Instance " << inst->id << " served " << inst->partiesServed
-                << " parties, total time: " << inst->totalTime << " seconds.\n";
+    for (auto &inst: sim.instances) {
+        cout << "Instance " << inst.id;
+        if (sim.instanceClasses.size() > 1) cout << " (" << sim.instanceClasses[inst.instanceClass].name << ")";
+        cout << " served " << inst.partiesServed
+                << " parties, total time: " << inst.totalTime << " seconds.\n";
     }
-    cout << "Leftover players: Tanks: " << tanks << ", Healers: " << healers << ", DPS: " << dps << endl;
+    RoleCounts roles = sim.loadRoles();
+    cout << "Leftover players: Tanks: " << roles.tanks << ", Healers: " << roles.healers << ", DPS: " << roles.dps
+            << endl;
+    cout << "Seed: " << sim.masterSeed << "\n";
+    if (sim.metricsEnabled) sim.printMetrics(cout, sim.lastCompletion);
 
     return 0;
 }
@@ -0,0 +1,3083 @@
+#ifndef STDISCM_P2_SIMULATOR_H
+#define STDISCM_P2_SIMULATOR_H
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <cstdint>
+#include<algorithm>
+#include <queue>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdarg>
+#include <charconv>
+#include <cerrno>
+#include <csignal>
+#include <memory>
+#include <bit>
+#include <coroutine>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if __has_include(<sys/socket.h>)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+using namespace std;
+
+// Player pool, split into regions and each region into skill bands. Each pool's tanks, healers and DPS are packed
+// into one word so a pass's parties are reserved by a single atomic subtraction.
+enum Role { Tank, Healer, Dps, kRoleCount };
+
+constexpr int kRoleBits = 21;
+constexpr uint64_t kRoleMask = (1ull << kRoleBits) - 1;
+constexpr int kMaxRoleCount = (int) kRoleMask;
+
+constexpr int kMaxSkillBands = 8;
+constexpr int kMaxRegions = 16;
+constexpr int kMaxPools = kMaxRegions * kMaxSkillBands;
+constexpr int kSkillLevels = 1000; // player skill is 0 .. kSkillLevels - 1
+
+
+struct RoleCounts {
+    int tanks, healers, dps;
+};
+
+inline RoleCounts unpackRoles(uint64_t pool) {
+    return {(int) (pool & kRoleMask), (int) ((pool >> kRoleBits) & kRoleMask), (int) (pool >> (2 * kRoleBits))};
+}
+
+// A party composition: how many players of each role one party needs
+struct PartyKind {
+    string name;
+    int need[kRoleCount];
+    int size; // players per party
+    uint64_t cost; // need packed like rolePools, subtracted once per party formed
+};
+
+constexpr int kMaxPartyKinds = 8;
+constexpr int kMaxPartyNeed = 1000;
+
+inline PartyKind makePartyKind(const string &name, int tanks, int healers, int dps) {
+    return {name, {tanks, healers, dps}, tanks + healers + dps,
+            (uint64_t) tanks | ((uint64_t) healers << kRoleBits) | ((uint64_t) dps << (2 * kRoleBits))};
+}
+
+// Most parties of one kind the given role counts can fill
+inline int fitCount(const PartyKind &kind, const int left[]) {
+    int fit = numeric_limits<int>::max();
+    for (int role = 0; role < kRoleCount; ++role)
+        if (kind.need[role] > 0) fit = min(fit, left[role] / kind.need[role]);
+    return fit;
+}
+
+// How many parties of each kind to form from one band's players
+struct PartyPlan {
+    int counts[kMaxPartyKinds] = {};
+    int parties = 0;
+    int players = 0;
+};
+
+// Depth-first branch and bound over the kinds, largest first, trying the most parties of each kind first so
+// the first plan reached is the greedy one. fit[k] caps the parties of kinds 0..k together (the instances big
+// enough for kind k). The node budget bounds a pass when the pool is huge; the best plan found so far is kept.
+struct PlanSearch {
+    const vector<PartyKind> &partyKinds; // the simulation's, largest first
+    const int *fit;
+    int budget = 1024;
+    PartyPlan best, current;
+
+    PlanSearch(const vector<PartyKind> &partyKinds_, const int *fit_) : partyKinds(partyKinds_), fit(fit_) {}
+
+    // Upper bound on the players kinds from `first` on can seat: each role caps it by the kind that needs the
+    // least of that role per player
+    long long restBound(size_t first, const int left[], int instancesLeft) const {
+        if (first == partyKinds.size()) return 0;
+        long long bound = min((long long) left[0] + left[1] + left[2],
+                              (long long) instancesLeft * partyKinds[first].size);
+        for (int role = 0; role < kRoleCount; ++role) {
+            double perPlayer = numeric_limits<double>::infinity();
+            for (size_t kind = first; kind < partyKinds.size(); ++kind)
+                perPlayer = min(perPlayer, (double) partyKinds[kind].need[role] / partyKinds[kind].size);
+            if (perPlayer > 0) bound = min(bound, (long long) (left[role] / perPlayer + 1e-9));
+        }
+        return bound;
+    }
+
+    void search(size_t kind, int left[]) {
+        if (current.players > best.players) best = current;
+        if (kind == partyKinds.size() || --budget < 0) return;
+
+        const PartyKind &party = partyKinds[kind];
+        int instancesLeft = fit[partyKinds.size() - 1] - current.parties;
+        for (int count = min(fitCount(party, left), fit[kind] - current.parties); count >= 0 && budget >= 0;
+             --count) {
+            for (int role = 0; role < kRoleCount; ++role) left[role] -= count * party.need[role];
+            // Not monotone in count: giving back a party can free more of a role than it seats, raising the bound
+            // for the later kinds, so a pruned count is skipped rather than ending the loop
+            long long bound = current.players + (long long) count * party.size +
+                              restBound(kind + 1, left, instancesLeft - count);
+            if (bound > best.players) {
+                current.counts[kind] = count;
+                current.parties += count;
+                current.players += count * party.size;
+                search(kind + 1, left);
+                current.counts[kind] = 0;
+                current.parties -= count;
+                current.players -= count * party.size;
+            }
+            for (int role = 0; role < kRoleCount; ++role) left[role] += count * party.need[role];
+        }
+    }
+};
+
+// Queued players of one role and pool in arrival order: struct-of-arrays ring big enough for a full role field,
+// so pushing and taking never allocate (pages are only touched as the queue grows). One producer writes entries
+// and then publishes them by adding to rolePools; the scheduler reads what it reserved and advances head.
+struct PlayerQueue {
+    static constexpr size_t kCapacity = size_t(1) << kRoleBits;
+    static constexpr size_t kMask = kCapacity - 1;
+
+    unique_ptr<uint32_t[]> ids = make_unique_for_overwrite<uint32_t[]>(kCapacity);
+    unique_ptr<double[]> enqueuedAt = make_unique_for_overwrite<double[]>(kCapacity);
+    unique_ptr<uint16_t[]> skills = make_unique_for_overwrite<uint16_t[]>(kCapacity);
+    size_t tail = 0; // producer-owned
+    atomic<size_t> head{0}; // scheduler-owned, read by the producer to find free room
+
+    size_t room() const {
+        return kCapacity - (tail - head.load(memory_order_acquire));
+    }
+};
+
+// Philox4x32-10 counter-based generator (Salmon et al., SC'11). Each block of four outputs is a pure function
+// of (key, counter), so a stream is just a key and a position: no shared state, no locks, and the same draws
+// whichever thread makes them. Streams share the master seed as key and are told apart by the counter's high half.
+struct Philox {
+    using result_type = uint32_t;
+
+    uint32_t key[2] = {};
+    uint32_t counter[4] = {}; // [0..1] position in the stream, [2..3] stream id
+    uint32_t block[4] = {};
+    int used = 4; // outputs of block already returned
+
+    Philox() = default;
+
+    Philox(uint64_t seed, uint64_t stream) : key{(uint32_t) seed, (uint32_t) (seed >> 32)} {
+        counter[2] = (uint32_t) stream;
+        counter[3] = (uint32_t) (stream >> 32);
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return numeric_limits<uint32_t>::max(); }
+
+    result_type operator()() {
+        if (used == 4) {
+            generate();
+            used = 0;
+        }
+        return block[used++];
+    }
+
+    void generate() {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = 0xD2511F53ull * c0, p1 = 0xCD9E8D57ull * c2;
+            c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+            c1 = (uint32_t) p1;
+            c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+            c3 = (uint32_t) p0;
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        block[0] = c0;
+        block[1] = c1;
+        block[2] = c2;
+        block[3] = c3;
+        if (++counter[0] == 0) ++counter[1];
+    }
+};
+
+// Stream ids under the master seed
+constexpr uint64_t kArrivalStream = 1;
+constexpr uint64_t kSkillStream = 2;
+constexpr uint64_t kRunStream = 1ull << 32; // + instance id: each instance draws its own run times
+
+// Binary event trace: a TraceHeader, then fixed-size TraceRecords in native byte order, so a trace can be
+// memory-mapped and read in place. Records come grouped by the thread that made them, not in event order.
+// Arrivals are recorded as requested (before any rejection) so a replay sees the same workload; per-player skills
+// are redrawn from the recorded seed.
+enum class TraceEvent : uint8_t { Arrival, Assign, Start, Complete };
+
+struct TraceHeader {
+    char magic[8]; // "DGNTRACE"
+    uint32_t version;
+    uint32_t instanceCount;
+    uint64_t seed;
+    uint64_t recordCount;
+};
+
+struct TraceRecord {
+    double time; // simulated seconds
+    uint32_t instance; // Arrival: role
+    uint32_t party; // Arrival: player count
+    int32_t duration; // Arrival: skill, -1 when drawn per player
+    TraceEvent event;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(TraceRecord) == 24, "trace records are 24 bytes on disk");
+
+constexpr char kTraceMagic[8] = {'D', 'G', 'N', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t kTraceVersion = 1;
+
+// Serial numbers for objects that keep per-thread state, so a thread-local cache left by a finished simulation is
+// never taken for a later one's, even one at the same address
+inline atomic<uint64_t> nextSerial{1};
+
+// Each thread appends to its own buffer and writes it out in chunks, so records from one thread stay in order
+// while recording costs one lock per chunk rather than per event
+struct TraceRecorder {
+    static constexpr size_t kChunk = 4096;
+
+    FILE *out = nullptr;
+    mutex m; // guards out, buffers and recordCount
+    vector<unique_ptr<vector<TraceRecord> > > buffers;
+    uint64_t recordCount = 0;
+    TraceHeader header{};
+    uint64_t serial = nextSerial.fetch_add(1, memory_order_relaxed);
+
+    bool open(const string &path, uint32_t instanceCount, uint64_t seed) {
+        out = fopen(path.c_str(), "wb");
+        if (!out) return false;
+        memcpy(header.magic, kTraceMagic, sizeof(kTraceMagic));
+        header.version = kTraceVersion;
+        header.instanceCount = instanceCount;
+        header.seed = seed;
+        fwrite(&header, sizeof(header), 1, out);
+        return true;
+    }
+
+    void record(TraceEvent event, double time, int instance, int party, int duration) {
+        thread_local uint64_t owner = 0; // serial of the recorder the buffer belongs to
+        thread_local vector<TraceRecord> *buffer = nullptr;
+        if (owner != serial) {
+            lock_guard<mutex> lock(m);
+            buffers.push_back(make_unique<vector<TraceRecord> >());
+            buffer = buffers.back().get();
+            buffer->reserve(kChunk);
+            owner = serial;
+        }
+        buffer->push_back({time, (uint32_t) instance, (uint32_t) party, duration, event, {}});
+        if (buffer->size() == kChunk) {
+            lock_guard<mutex> lock(m);
+            flush(*buffer);
+        }
+    }
+
+    void flush(vector<TraceRecord> &buffer) {
+        fwrite(buffer.data(), sizeof(TraceRecord), buffer.size(), out);
+        recordCount += buffer.size();
+        buffer.clear();
+    }
+
+    // Writes out every buffer and the final record count; all recording threads must have finished
+    void close() {
+        if (!out) return;
+        lock_guard<mutex> lock(m);
+        for (auto &buffer: buffers) flush(*buffer);
+        header.recordCount = recordCount;
+        fseek(out, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, out);
+        fclose(out);
+        out = nullptr;
+    }
+};
+
+// A trace being replayed: arrivals feed the arrival process in time order and each party runs for its recorded
+// run time. The file is in recording-thread order, so load indexes both.
+struct TraceReplay {
+    const TraceHeader *header = nullptr;
+    const TraceRecord *records = nullptr;
+    size_t count = 0;
+    vector<uint32_t> arrivals; // Arrival records by time; ties keep their thread's order
+    vector<int32_t> durations; // recorded run time by party number, -1 for parties the trace never started
+    vector<char> storage; // the file contents where it cannot be mapped
+
+    bool active() const { return records != nullptr; }
+
+    // The run time recorded for a party, or -1 if it has none
+    int durationOf(int party) const {
+        return party >= 0 && (size_t) party < durations.size() ? durations[party] : -1;
+    }
+
+    bool load(const string &path, string &error) {
+        const char *data = nullptr;
+        size_t size = 0;
+#if __has_include(<sys/mman.h>)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info{};
+        if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapped = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = (const char *) mapped;
+                size = (size_t) info.st_size;
+            }
+        }
+        if (fd >= 0) ::close(fd);
+#endif
+        if (!data) {
+            ifstream file(path, ios::binary);
+            storage.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            data = storage.data();
+            size = storage.size();
+        }
+        if (size < sizeof(TraceHeader) || memcmp(data, kTraceMagic, sizeof(kTraceMagic)) != 0) {
+            error = "not an event trace: " + path;
+            return false;
+        }
+        header = (const TraceHeader *) data;
+        if (header->version != kTraceVersion ||
+            header->recordCount > (size - sizeof(TraceHeader)) / sizeof(TraceRecord)) {
+            error = "unsupported or truncated event trace: " + path;
+            return false;
+        }
+        records = (const TraceRecord *) (data + sizeof(TraceHeader));
+        count = header->recordCount;
+
+        for (size_t i = 0; i < count; ++i) {
+            if (records[i].event == TraceEvent::Arrival) {
+                arrivals.push_back((uint32_t) i);
+            } else if (records[i].event == TraceEvent::Start && records[i].party <= count) { // numbered from 1
+                if (records[i].party >= durations.size()) durations.resize(records[i].party + 1, -1);
+                durations[records[i].party] = records[i].duration;
+            }
+        }
+        stable_sort(arrivals.begin(), arrivals.end(), [this](uint32_t a, uint32_t b) {
+            return records[a].time < records[b].time;
+        });
+        return true;
+    }
+};
+
+// Execution backend: one thread per instance, a fixed pool driving instances as state records, a fixed pool
+// resuming one coroutine per instance, or a discrete-event loop over simulated time with no real sleeps
+enum class Backend { Threads, Pool, Coroutine, Virtual };
+
+constexpr int kMaxPoolWorkers = 4096;
+
+// SIGINT asks every running simulation to drain
+inline volatile sig_atomic_t interruptRequested = 0;
+
+// Player arrival process: Poisson per role (rates in players per simulated second) or a replayed trace of
+// "time role [count [skill]]" lines. Yields arrivals in time order until the trace ends or arrivalLimit passes.
+struct Arrival {
+    double time;
+    Role role;
+    int count;
+    int skill; // -1 draws a skill per player
+};
+
+struct ArrivalProcess {
+    double rates[kRoleCount] = {};
+    double nextTime[kRoleCount] = {};
+    Philox gen; // seeded by start()
+    ifstream trace;
+    bool fromTrace = false;
+    size_t replayPos = 0; // into replay.arrivals
+    double arrivalLimit = numeric_limits<double>::infinity();
+    const TraceReplay &replay; // the simulation's; while active it is the only source
+
+    explicit ArrivalProcess(const TraceReplay &replay_) : replay(replay_) {}
+
+    bool configured() const {
+        return replay.active() || fromTrace || rates[Tank] > 0 || rates[Healer] > 0 || rates[Dps] > 0;
+    }
+
+    double draw(Role role) {
+        if (rates[role] <= 0) return numeric_limits<double>::infinity();
+        return exponential_distribution<double>(rates[role])(gen);
+    }
+
+    void start(uint64_t seed) {
+        gen = Philox(seed, kArrivalStream);
+        for (int role = 0; role < kRoleCount; ++role) nextTime[role] = draw((Role) role);
+    }
+
+    bool next(Arrival &arrival) {
+        if (replay.active()) {
+            if (replayPos == replay.arrivals.size()) return false;
+            const TraceRecord &record = replay.records[replay.arrivals[replayPos++]];
+            arrival = {record.time, (Role) record.instance, (int) record.party, record.duration};
+            return arrival.time <= arrivalLimit;
+        }
+        if (fromTrace) {
+            string line;
+            while (getline(trace, line)) {
+                istringstream fields(line.substr(0, line.find('#')));
+                string role;
+                arrival.count = 1;
+                arrival.skill = -1;
+                if (!(fields >> arrival.time >> role)) continue;
+                fields >> arrival.count >> arrival.skill;
+                if (role == "tank" || role == "tanks") arrival.role = Tank;
+                else if (role == "healer" || role == "healers") arrival.role = Healer;
+                else if (role == "dps") arrival.role = Dps;
+                else continue;
+                return arrival.time <= arrivalLimit;
+            }
+            return false;
+        }
+        auto role = (Role) (min_element(nextTime, nextTime + kRoleCount) - nextTime);
+        arrival = {nextTime[role], role, 1, -1};
+        nextTime[role] += draw(role);
+        return arrival.time <= arrivalLimit;
+    }
+};
+
+// Asynchronous log sink: producers claim fixed-size records in a bounded lock-free ring (per-slot sequence
+// numbers) and a writer thread drains them to stdout or a file in batches. When the ring is full a record is
+// either dropped and counted, or the producer waits for the writer.
+enum class LogPolicy { Drop, Block };
+
+struct alignas(64) LogRecord {
+    atomic<size_t> sequence;
+    uint16_t length;
+    char text[118];
+};
+
+struct LogSink {
+    vector<LogRecord> slots;
+    size_t mask = 0;
+    LogPolicy policy = LogPolicy::Drop;
+    FILE *out = stdout;
+
+    atomic<size_t> enqueuePos{0};
+    size_t dequeuePos = 0; // writer-owned
+    atomic<uint32_t> published{0};
+    atomic<bool> writerWaiting{false};
+    atomic<bool> stopping{false};
+    atomic<uint64_t> dropped{0};
+    thread writer;
+
+    void start(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots = vector<LogRecord>(size);
+        for (size_t i = 0; i < size; ++i) slots[i].sequence.store(i, memory_order_relaxed);
+        mask = size - 1;
+        enqueuePos = 0;
+        dequeuePos = 0;
+        stopping = false;
+        writer = thread(&LogSink::writerLoop, this);
+    }
+
+    void push(const char *text, size_t length) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        LogRecord *slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            auto diff = (intptr_t) slot->sequence.load(memory_order_acquire) - (intptr_t) pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                if (policy == LogPolicy::Drop) {
+                    dropped.fetch_add(1, memory_order_relaxed);
+                    return;
+                }
+                this_thread::yield();
+                pos = enqueuePos.load(memory_order_relaxed);
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+
+        slot->length = (uint16_t) min(length, sizeof(slot->text));
+        memcpy(slot->text, text, slot->length);
+        slot->sequence.store(pos + 1, memory_order_release);
+
+        published.fetch_add(1, memory_order_seq_cst);
+        if (writerWaiting.load(memory_order_seq_cst)) published.notify_one();
+    }
+
+    void writerLoop() {
+        string batch;
+        batch.reserve(slots.size() * sizeof(LogRecord::text));
+        while (true) {
+            uint32_t seen = published.load(memory_order_seq_cst);
+            while (true) {
+                LogRecord &slot = slots[dequeuePos & mask];
+                if (slot.sequence.load(memory_order_acquire) != dequeuePos + 1) break;
+                batch.append(slot.text, slot.length);
+                slot.sequence.store(dequeuePos + mask + 1, memory_order_release);
+                dequeuePos++;
+            }
+            if (!batch.empty()) {
+                fwrite(batch.data(), 1, batch.size(), out);
+                fflush(out);
+                batch.clear();
+                continue;
+            }
+            if (stopping.load()) break;
+            writerWaiting.store(true, memory_order_seq_cst);
+            published.wait(seen, memory_order_seq_cst);
+            writerWaiting.store(false, memory_order_relaxed);
+        }
+    }
+
+    // Drains whatever is queued; producers must have finished
+    void stop() {
+        if (!writer.joinable()) return;
+        stopping = true;
+        published.fetch_add(1, memory_order_seq_cst);
+        published.notify_one();
+        writer.join();
+        if (out != stdout) fclose(out);
+    }
+};
+
+// Appends digits without a temporary string, so a buffer reused at its reserved capacity never allocates
+inline void appendNumber(string &out, long long value) {
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof digits, value).ptr);
+}
+
+// Log-linear histogram (8 sub-buckets per power of two, ~12% resolution) with a single writer; counts are
+// relaxed atomics so a report can be taken while the writer keeps going.
+struct Histogram {
+    static constexpr int kSubBits = 3;
+    static constexpr int kLinear = 2 << kSubBits;
+    static constexpr int kBuckets = kLinear + (64 - kSubBits - 1) * (1 << kSubBits);
+
+    atomic<uint64_t> counts[kBuckets] = {};
+    atomic<uint64_t> maxValue{0};
+    atomic<uint64_t> sum{0}; // of every value recorded, for exporters
+
+    static int bucketOf(uint64_t value) {
+        if (value < (uint64_t) kLinear) return (int) value;
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = (int) (value >> (exponent - kSubBits)) & ((1 << kSubBits) - 1);
+        return kLinear + (exponent - kSubBits - 1) * (1 << kSubBits) + sub;
+    }
+
+    static uint64_t lowerBound(int bucket) {
+        if (bucket < kLinear) return bucket;
+        int exponent = (bucket - kLinear) / (1 << kSubBits) + kSubBits + 1;
+        int sub = (bucket - kLinear) % (1 << kSubBits);
+        return ((uint64_t) ((1 << kSubBits) + sub)) << (exponent - kSubBits);
+    }
+
+    // Largest value the bucket holds
+    static uint64_t upperBound(int bucket) {
+        return bucket + 1 < kBuckets ? lowerBound(bucket + 1) - 1 : numeric_limits<uint64_t>::max();
+    }
+
+    void record(uint64_t value, uint64_t times = 1) {
+        auto &count = counts[bucketOf(value)];
+        count.store(count.load(memory_order_relaxed) + times, memory_order_relaxed);
+        sum.store(sum.load(memory_order_relaxed) + value * times, memory_order_relaxed);
+        if (value > maxValue.load(memory_order_relaxed)) maxValue.store(value, memory_order_relaxed);
+    }
+};
+
+// Merged, plain copy of histograms for reporting
+struct HistogramSummary {
+    uint64_t counts[Histogram::kBuckets] = {};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+    uint64_t sum = 0;
+
+    void add(const Histogram &histogram) {
+        maxValue = max(maxValue, histogram.maxValue.load(memory_order_relaxed));
+        sum += histogram.sum.load(memory_order_relaxed);
+        for (int i = 0; i < Histogram::kBuckets; ++i) {
+            uint64_t count = histogram.counts[i].load(memory_order_relaxed);
+            counts[i] += count;
+            total += count;
+        }
+    }
+
+    // Bucket holding the p-quantile, or -1 when empty
+    int bucketAt(double p) const {
+        if (total == 0) return -1;
+        auto rank = (uint64_t) (p * (double) (total - 1));
+        uint64_t seen = 0;
+        for (int i = 0; i < Histogram::kBuckets; ++i) {
+            seen += counts[i];
+            if (seen > rank) return i;
+        }
+        return -1;
+    }
+
+    // Midpoint of the quantile's bucket (within ~6% either way), never above the largest value recorded
+    uint64_t percentile(double p) const {
+        int bucket = bucketAt(p);
+        if (bucket < 0) return 0;
+        uint64_t lower = Histogram::lowerBound(bucket), upper = min(Histogram::upperBound(bucket), maxValue);
+        return upper > lower ? lower + (upper - lower) / 2 : lower;
+    }
+
+    // Largest value the quantile's bucket can hold: a bound that never understates the quantile, for SLO checks
+    uint64_t percentileUpper(double p) const {
+        int bucket = bucketAt(p);
+        return bucket < 0 ? 0 : min(Histogram::upperBound(bucket), maxValue);
+    }
+
+    // What was recorded after an earlier summary of the same histograms (maxValue stays the overall one)
+    HistogramSummary since(const HistogramSummary &earlier) const {
+        HistogramSummary window = *this;
+        for (int i = 0; i < Histogram::kBuckets; ++i) window.counts[i] -= earlier.counts[i];
+        window.total -= earlier.total;
+        window.sum -= earlier.sum;
+        return window;
+    }
+};
+
+// Instrumented sites (DUNGEON_INSTRUMENT builds only)
+enum LockSite { InstanceLock, PoolLock, RegionLock, kLockSites };
+enum CvSite { SchedulerCv, InstanceCv, PoolCv, ArrivalCv, kCvSites };
+enum TimerSite { AssignPassTimer, CompletionTimer, kTimerSites };
+
+constexpr const char *kLockSiteNames[kLockSites] = {"instance", "pool", "region pools"};
+constexpr const char *kCvSiteNames[kCvSites] = {"scheduler doorbell", "instance doorbell", "cv_pool", "cv_arrivals"};
+constexpr const char *kTimerSiteNames[kTimerSites] = {"assignment pass", "completion path"};
+
+// Per-thread metric counters; each thread writes only its own shard, reports merge all of them
+struct MetricsShard {
+    Histogram partyWaitMs;       // simulated time from the party's last member queueing to assignment
+    Histogram playerWaitMs;      // simulated time each player spent queued
+    Histogram assignLatencyNs;   // wall time from a wakeup request to the parties being dispatched
+#ifdef DUNGEON_INSTRUMENT
+    Histogram lockWaitNs[kLockSites];   // wall time spent acquiring
+    Histogram lockHoldNs[kLockSites];   // wall time held, for the short hot-path sections
+    atomic<uint64_t> cvWaits[kCvSites] = {};     // waits that blocked, on a condition variable or doorbell
+    atomic<uint64_t> cvWakeups[kCvSites] = {};
+    atomic<uint64_t> cvSpurious[kCvSites] = {};  // wakeups that found the predicate still false
+    Histogram timerNs[kTimerSites];
+#endif
+    atomic<uint64_t> partiesFormed{0};
+    atomic<uint64_t> partiesByKind[kMaxPartyKinds] = {};
+    atomic<uint64_t> runsCompleted{0};
+
+    static void bump(atomic<uint64_t> &counter, uint64_t by = 1) {
+        counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+};
+
+#ifdef DUNGEON_INSTRUMENT
+// Completions so far, over every simulation in the process; the benchmark counts the allocations made once past
+// its warm-up runs
+inline atomic<uint64_t> runsEnded{0};
+#endif
+
+inline atomic<bool> metricsRequested{false}; // SIGUSR1 asks the monitor loop for a report
+
+// One simulation's metric shards; a thread gets a shard of its own the first time it records into the simulation
+struct MetricsRegistry {
+    mutex m; // guards shards
+    vector<unique_ptr<MetricsShard> > shards;
+    uint64_t serial = nextSerial.fetch_add(1, memory_order_relaxed);
+
+    MetricsShard &local() {
+        thread_local uint64_t owner = 0; // serial of the registry the cached shard belongs to
+        thread_local MetricsShard *shard = nullptr;
+        if (owner != serial) {
+            lock_guard<mutex> lock(m);
+            shards.push_back(make_unique<MetricsShard>());
+            shard = shards.back().get();
+            owner = serial;
+        }
+        return *shard;
+    }
+};
+
+inline int64_t wallNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lock and condition variable instrumentation. Built with -DDUNGEON_INSTRUMENT (as the benchmark is) these
+// record per-site acquisition waits, hold times, cv waits and wakeups and scoped timers into the thread's
+// shard of the simulation's metrics; otherwise they compile down to the plain standard calls.
+
+// Short critical section on the hot path
+#ifdef DUNGEON_INSTRUMENT
+struct TimedLock {
+    MetricsRegistry &metrics;
+    mutex &m;
+    LockSite site;
+    int64_t acquired;
+
+    TimedLock(MetricsRegistry &metrics_, mutex &m_, LockSite site_) : metrics(metrics_), m(m_), site(site_) {
+        int64_t requested = wallNanos();
+        m.lock();
+        acquired = wallNanos();
+        metrics.local().lockWaitNs[site].record(acquired - requested);
+    }
+
+    ~TimedLock() {
+        int64_t held = wallNanos() - acquired;
+        m.unlock();
+        metrics.local().lockHoldNs[site].record(held);
+    }
+};
+#else
+struct TimedLock : lock_guard<mutex> {
+    TimedLock(MetricsRegistry &, mutex &m, LockSite) : lock_guard<mutex>(m) {}
+};
+#endif
+
+// Re-take a unique_lock released for the unlocked part of a loop
+inline void relock([[maybe_unused]] MetricsRegistry &metrics, unique_lock<mutex> &lock,
+                   [[maybe_unused]] LockSite site) {
+#ifdef DUNGEON_INSTRUMENT
+    int64_t requested = wallNanos();
+    lock.lock();
+    metrics.local().lockWaitNs[site].record(wallNanos() - requested);
+#else
+    lock.lock();
+#endif
+}
+
+// cv.wait(lock, ready), counting blocking waits, wakeups and wakeups that found ready() still false
+template<typename Predicate>
+void cvWait([[maybe_unused]] MetricsRegistry &metrics, condition_variable &cv, unique_lock<mutex> &lock,
+            [[maybe_unused]] CvSite site, Predicate ready) {
+#ifdef DUNGEON_INSTRUMENT
+    if (ready()) return;
+    MetricsShard &shard = metrics.local();
+    MetricsShard::bump(shard.cvWaits[site]);
+    while (true) {
+        cv.wait(lock);
+        MetricsShard::bump(shard.cvWakeups[site]);
+        if (ready()) return;
+        MetricsShard::bump(shard.cvSpurious[site]);
+    }
+#else
+    cv.wait(lock, ready);
+#endif
+}
+
+// cv.wait_until(lock, deadline, ready), counted like cvWait; timeouts are not wakeups
+template<typename Predicate>
+bool cvWaitUntil([[maybe_unused]] MetricsRegistry &metrics, condition_variable &cv, unique_lock<mutex> &lock,
+                 chrono::steady_clock::time_point deadline, [[maybe_unused]] CvSite site, Predicate ready) {
+#ifdef DUNGEON_INSTRUMENT
+    if (ready()) return true;
+    MetricsShard &shard = metrics.local();
+    MetricsShard::bump(shard.cvWaits[site]);
+    while (true) {
+        if (cv.wait_until(lock, deadline) == cv_status::timeout) return ready();
+        MetricsShard::bump(shard.cvWakeups[site]);
+        if (ready()) return true;
+        MetricsShard::bump(shard.cvSpurious[site]);
+    }
+#else
+    return cv.wait_until(lock, deadline, ready);
+#endif
+}
+
+// Wall time of the enclosing scope
+struct ScopedTimer {
+#ifdef DUNGEON_INSTRUMENT
+    MetricsRegistry &metrics;
+    TimerSite site;
+    int64_t start;
+
+    ScopedTimer(MetricsRegistry &metrics_, TimerSite site_) : metrics(metrics_), site(site_), start(wallNanos()) {}
+
+    ~ScopedTimer() {
+        metrics.local().timerNs[site].record(wallNanos() - start);
+    }
+#else
+    ScopedTimer(MetricsRegistry &, TimerSite) {}
+#endif
+};
+
+// Single-sleeper wakeup over C++20 atomic wait/notify, as the log writer waits. Whoever changes the sleeper's
+// state rings afterwards: one atomic add, plus a futex wake only while the sleeper is parked. Wakers take no
+// lock, so a burst of completions cannot convoy on the scheduler.
+struct Doorbell {
+    atomic<uint32_t> rings{0};
+    atomic<bool> parked{false};
+
+    void ring() {
+        rings.fetch_add(1, memory_order_seq_cst);
+        if (parked.load(memory_order_seq_cst)) rings.notify_one();
+    }
+
+    // Returns once ready() holds, re-checking it after every ring; only the owning thread may wait
+    template<typename Predicate>
+    void wait([[maybe_unused]] MetricsRegistry &metrics, [[maybe_unused]] CvSite site, Predicate ready) {
+#ifdef DUNGEON_INSTRUMENT
+        MetricsShard &shard = metrics.local();
+        bool blocked = false;
+#endif
+        while (true) {
+            uint32_t seen = rings.load(memory_order_seq_cst);
+            if (ready()) return;
+#ifdef DUNGEON_INSTRUMENT
+            MetricsShard::bump(blocked ? shard.cvSpurious[site] : shard.cvWaits[site]);
+            blocked = true;
+#endif
+            parked.store(true, memory_order_seq_cst);
+            rings.wait(seen, memory_order_seq_cst);
+            parked.store(false, memory_order_relaxed);
+#ifdef DUNGEON_INSTRUMENT
+            MetricsShard::bump(shard.cvWakeups[site]);
+#endif
+        }
+    }
+};
+
+// Seqlock over a trivially copyable value: one writer at a time publishes, any number of observers read a
+// consistent copy without blocking it. The payload lives in relaxed atomic words so torn reads are retried, not UB.
+template<typename T>
+struct SeqLock {
+    static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    atomic<uint32_t> sequence{0};
+    atomic<uint64_t> words[kWords] = {};
+
+    void store(const T &value) {
+        uint64_t buffer[kWords] = {};
+        memcpy(buffer, &value, sizeof(T));
+        uint32_t seq = sequence.load(memory_order_relaxed);
+        sequence.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (size_t i = 0; i < kWords; ++i) words[i].store(buffer[i], memory_order_relaxed);
+        sequence.store(seq + 2, memory_order_release);
+    }
+
+    T load() const {
+        uint64_t buffer[kWords];
+        uint32_t before, after;
+        do {
+            before = sequence.load(memory_order_acquire);
+            for (size_t i = 0; i < kWords; ++i) buffer[i] = words[i].load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            after = sequence.load(memory_order_relaxed);
+        } while (before != after || (before & 1));
+        T value;
+        memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+};
+
+// Run-time distribution of an instance class, in whole simulated seconds
+struct DurationDistribution {
+    enum Shape { Uniform, Normal, Lognormal, Empirical } shape = Uniform;
+    double a = 0, b = 0; // uniform [a, b]; normal mean and stddev; lognormal mu and sigma of ln(seconds)
+    vector<int> seconds; // empirical: histogram bin values, drawn by weight
+    discrete_distribution<size_t> bins;
+
+    // Continuous shapes round to a whole second, never below 1
+    static int toSeconds(double value) {
+        return (int) min(max(round(value), 1.0), (double) numeric_limits<int>::max());
+    }
+
+    int sample(Philox &gen) {
+        switch (shape) {
+            case Uniform: return uniform_int_distribution<int>((int) a, (int) b)(gen);
+            case Normal: return toSeconds(normal_distribution<double>(a, b)(gen));
+            case Lognormal: return toSeconds(lognormal_distribution<double>(a, b)(gen));
+            case Empirical: return seconds[bins(gen)];
+        }
+        return 0;
+    }
+};
+
+// A kind of dungeon instance: how many the fleet has, the largest party it hosts and how long its runs take
+struct InstanceClass {
+    string name;
+    int count;
+    int capacity; // players
+    DurationDistribution duration;
+};
+
+constexpr int kMaxInstanceClasses = 8;
+
+// What observers (the monitor loop, exporters) see of an instance
+struct InstanceStatus {
+    bool hasParty;
+    bool running;
+    int currDungeonDuration;
+    int partiesServed;
+    int totalTime;
+    double runStart;
+};
+
+// One instance. The fleet sits side by side in a single arena, each instance on cache lines of its own so threads
+// driving neighbouring instances never false-share: first what changes on every assignment and run, then the
+// status observers poll on a line to itself, then what stays fixed for the run and the run-time stream.
+struct alignas(64) Instance {
+    mutex m; // guards this instance's state
+    Doorbell bell; // rung by the scheduler on assignment and by shutdown
+    bool hasParty = false;
+    bool running = false;
+    int currDungeonDuration = 0;
+    double runStart = 0; // simulated start of the current run; observers derive progress from it
+    int partiesServed = 0;
+    int totalTime = 0;
+    int partyKind = 0; // index into partyKinds of the party assigned
+    int partyId = 0; // number of the party assigned, as in the event trace
+    int nextFree = -1; // intrusive free-list link (index into instances)
+    int nextTimer = -1; // pool backend: completion timer link (index into instances) and its tick
+    int64_t timerTick = 0;
+    coroutine_handle<> lifecycle; // coroutine backend: this instance's suspended lifecycle
+
+    alignas(64) SeqLock<InstanceStatus> status; // republished on every state change, with m held
+
+    alignas(64) int id = 0;
+    int instanceClass = 0; // index into instanceClasses
+    int region = 0; // index into regionState
+    Philox rng; // run-time stream, drawn only by whoever starts this instance's run
+
+    Instance() = default;
+
+    // Slot index of the arena, before any thread sees the instance
+    void init(int index, int instanceClass_, int region_, uint64_t seed) {
+        id = index + 1;
+        instanceClass = instanceClass_;
+        region = region_;
+        rng = Philox(seed, kRunStream + id);
+        publishStatus();
+    }
+
+    void publishStatus() {
+        status.store({hasParty, running, currDungeonDuration, partiesServed, totalTime, runStart});
+    }
+
+    ~Instance() {
+        if (lifecycle) lifecycle.destroy();
+    }
+
+    Instance(const Instance &) = delete;
+
+    Instance &operator=(const Instance &) = delete;
+
+    Instance(Instance &&) = delete;
+
+    Instance &operator=(Instance &&) = delete;
+};
+
+// The whole fleet in one allocation, made once per run; instances are referred to by index or plain pointer
+struct InstanceArena {
+    unique_ptr<Instance[]> slots;
+    size_t count = 0;
+
+    void allocate(size_t n) {
+        slots = make_unique<Instance[]>(n);
+        count = n;
+    }
+
+    Instance &operator[](size_t index) { return slots[index]; }
+    Instance *begin() { return slots.get(); }
+    Instance *end() { return slots.get() + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+// One shard of the simulation: every regions-th instance, the region's pools and a scheduler of its own.
+// Completions push freed instances onto the region's lock-free released stack threaded through
+// Instance::nextFree; its scheduler, the only consumer, takes it whole with one exchange into its own free set
+// (see the instance selection policies).
+struct Region {
+    atomic<int> releasedHead{-1};
+    atomic<int> busy{0}; // instances assigned or running
+    atomic<int> size{0}; // instances in service; autoscaling changes it during the run
+    Doorbell bell; // the region's scheduler sleeps on this; completions, arrivals and drains ring it
+    mutex takeMutex; // with --steal, held by whichever scheduler is taking players from the region's pools
+    mutex scaleMutex; // guards parked and, while the run is going, changes to size
+    vector<int> parked; // autoscaling: instances out of service, lowest index last
+    atomic<uint64_t> formed{0}; // parties its scheduler formed, stolen ones included
+    atomic<uint64_t> stolen{0};
+};
+
+constexpr double kControlInterval = 1.0; // autoscaling: simulated seconds between decisions in virtual time
+
+struct AutoscaleStats {
+    int peak = 0;
+    uint64_t added = 0; // retired ones are fleetAtStart + added - activeInstances
+    double activeSeconds = 0, lastAt = 0; // instances in service integrated over simulated time, up to lastAt
+    HistogramSummary seenWaits; // party waits as of the last decision
+};
+
+// Pool backend: a dungeon run is a start task followed by a completion timer at its wall-clock deadline
+struct PoolTask {
+    Instance *instance;
+    bool completion;
+};
+
+// Completion timers: a hierarchical timer wheel over wall-clock ticks of tickNs. Level L has 64 slots of 64^L
+// ticks each; a timer is filed at the level its distance calls for and moves down a level as its slot comes
+// round, so arming and firing are O(1) and the next tick at which anything happens is found from the occupancy
+// bits. Timers are instance indices linked through Instance::nextTimer, one per running instance.
+struct TimerWheel {
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 6;
+    static constexpr int kSlots = 1 << kSlotBits;
+    static constexpr int64_t kSpan = int64_t(1) << (kLevels * kSlotBits); // farthest distance filed exactly
+
+    int heads[kLevels][kSlots];
+    uint64_t occupied[kLevels] = {};
+    int64_t now = 0; // last tick processed; every timer left is due later
+    int pending = 0;
+    int64_t tickNs = 1000000;
+    InstanceArena &instances; // the fleet the timers index
+    const chrono::steady_clock::time_point &wallStart; // tick 0
+
+    TimerWheel(InstanceArena &instances_, const chrono::steady_clock::time_point &wallStart_)
+        : instances(instances_), wallStart(wallStart_) {
+        clear();
+    }
+
+    void clear() {
+        for (auto &level: heads) fill(begin(level), end(level), -1);
+        fill(begin(occupied), end(occupied), 0);
+        now = 0;
+        pending = 0;
+    }
+
+    // Tick of a wall time, rounded down to process up to it or up for a deadline, so nothing fires early
+    int64_t tickOf(chrono::steady_clock::time_point time, bool roundUp) const {
+        int64_t ns = max<int64_t>(0, chrono::duration_cast<chrono::nanoseconds>(time - wallStart).count());
+        return roundUp ? (ns + tickNs - 1) / tickNs : ns / tickNs;
+    }
+
+    chrono::steady_clock::time_point timeOf(int64_t tick) const {
+        return wallStart + chrono::nanoseconds(tick * tickNs);
+    }
+
+    // File by distance from now; beyond the top level's reach a timer waits in its last slot and is refiled
+    void place(int index) {
+        int64_t distance = min(instances[index].timerTick - now, kSpan - 1);
+        int level = 0;
+        while (level < kLevels - 1 && distance >> ((level + 1) * kSlotBits)) level++;
+        int slot = (int) (((now + distance) >> (level * kSlotBits)) & (kSlots - 1));
+        instances[index].nextTimer = heads[level][slot];
+        heads[level][slot] = index;
+        occupied[level] |= uint64_t(1) << slot;
+    }
+
+    int take(int level, int slot) {
+        int head = heads[level][slot];
+        heads[level][slot] = -1;
+        occupied[level] &= ~(uint64_t(1) << slot);
+        return head;
+    }
+
+    // Arms the instance's completion, never before the next tick; returns the tick it fires on
+    int64_t add(int index, int64_t tick) {
+        instances[index].timerTick = max(tick, now + 1);
+        place(index);
+        pending++;
+        return instances[index].timerTick;
+    }
+
+    // Next tick at which a timer fires or moves down a level (max when none is pending)
+    int64_t nextDue() const {
+        int64_t next = numeric_limits<int64_t>::max();
+        for (int level = 0; level < kLevels; ++level) {
+            if (!occupied[level]) continue;
+            int shift = level * kSlotBits;
+            int64_t slot = (now >> shift) + 1;
+            slot += countr_zero(rotr(occupied[level], (int) (slot & (kSlots - 1))));
+            next = min(next, slot << shift);
+        }
+        return next;
+    }
+
+    // Process every tick up to target, jumping straight between the ticks where something happens, and pass
+    // each fired instance index to fire
+    template<typename Fire>
+    void advance(int64_t target, Fire fire) {
+        for (int64_t next = nextDue(); next <= target; next = nextDue()) {
+            now = next;
+            for (int level = kLevels - 1; level > 0; --level) {
+                if (now & ((int64_t(1) << (level * kSlotBits)) - 1)) continue;
+                for (int index = take(level, (int) ((now >> (level * kSlotBits)) & (kSlots - 1))); index != -1;) {
+                    int following = instances[index].nextTimer;
+                    place(index);
+                    index = following;
+                }
+            }
+            for (int index = take(0, (int) (now & (kSlots - 1))); index != -1;) {
+                int following = instances[index].nextTimer;
+                pending--;
+                fire(index);
+                index = following;
+            }
+        }
+        now = max(now, target);
+    }
+};
+
+// Ready tasks in order, in a ring sized to the fleet when the run starts: an instance has at most one start or
+// fired completion queued at a time, so it never fills and never allocates
+struct TaskRing {
+    unique_ptr<PoolTask[]> tasks;
+    size_t mask = 0, head = 0, tail = 0;
+
+    void allocate(size_t capacity) {
+        size_t size = bit_ceil(max<size_t>(capacity, 1));
+        tasks = make_unique<PoolTask[]>(size);
+        mask = size - 1;
+        head = tail = 0;
+    }
+
+    bool empty() const { return head == tail; }
+    void push_back(PoolTask task) { tasks[tail++ & mask] = task; }
+    PoolTask pop_front() { return tasks[head++ & mask]; }
+};
+
+struct Simulation;
+
+// The --metrics-port server, serving writeExport and writeInstanceExport
+struct MetricsExporter {
+    Simulation *sim;
+    int port = 0; // 0: no exporter
+    int listenFd = -1;
+    atomic<bool> stopping{false};
+    thread server;
+
+    explicit MetricsExporter(Simulation *sim_) : sim(sim_) {}
+
+    // Bind and listen on the loopback interface, before the run so a taken port fails fast
+    bool open(string &error) {
+#if __has_include(<sys/socket.h>)
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((uint16_t) port);
+        if (listenFd < 0 || bind(listenFd, (sockaddr *) &address, sizeof address) != 0 || listen(listenFd, 16) != 0) {
+            error = "cannot listen on 127.0.0.1:" + to_string(port) + ": " + strerror(errno);
+            return false;
+        }
+        return true;
+#else
+        error = "--metrics-port needs POSIX sockets";
+        return false;
+#endif
+    }
+
+    // Serving starts once the fleet is built, and stops when the run ends
+    void start() {
+        if (listenFd >= 0) server = thread(&MetricsExporter::serve, this);
+    }
+
+    void stop() {
+        stopping = true;
+        if (server.joinable()) server.join();
+    }
+
+#if __has_include(<sys/socket.h>)
+    void serve(); // defined after the pages it serves
+#else
+    void serve() {}
+#endif
+};
+
+struct FreeInstances;
+struct FormedParty;
+struct Lifecycle;
+
+constexpr int kMaxLogCapacity = 1 << 22; // --log-capacity bound: 512 MiB of records
+
+// Run parameters, from flags, a config file or the prompts; plain values, so one configuration can be copied into
+// as many simulations as need it
+struct SimulationConfig {
+    int skillBands = 1; // FIFO matching ignores skill and keeps everyone in band 0
+    int regions = 1; // --regions: shards with their own pools, instances and scheduler
+    // Each region's share of arriving players (--regions W,W,...); equal unless given
+    int regionWeights[kMaxRegions] = {1};
+    int regionWeightTotal = 1;
+    bool stealing = false; // --steal: a region with instances to spare takes parties from regions that have none
+
+    // Kinds in play, largest first (prepareSimulation sorts configured ones); the 5-player dungeon unless --party
+    // is given
+    vector<PartyKind> partyKinds = {makePartyKind("dungeon", 1, 1, 3)};
+    int t1 = -1, t2 = -1; // dungeon run time bounds; -1 until given by a flag, config file or prompt
+    // Declared with --class; without any, prepareSimulation makes one class of every instance with uniform
+    // [t1, t2] runs
+    vector<InstanceClass> instanceClasses;
+    uint64_t masterSeed = 0; // --seed, or drawn from random_device and printed so the run can be replayed
+
+    // Admission control (--queue-cap T,H,D): at most cap players of a role wait over all pools. Arrivals over it
+    // are shed and counted, or with --admission block the producer is held back until the schedulers take players.
+    int queueCap[kRoleCount] = {kMaxRoleCount, kMaxRoleCount, kMaxRoleCount};
+    bool admissionBlocks = false;
+
+    Backend backend = Backend::Threads;
+    int poolWorkers = 0; // --workers: pool and coroutine backends; 0 means one per hardware thread
+    // Real-time backends map wall time through timeScale (simulated seconds per wall second); a paced virtual-time
+    // run sleeps to it between events
+    double timeScale = 1.0;
+    bool paced = false;
+
+    string matchPolicy = "fifo"; // fifo | lwf | skill
+    string selectPolicy = "first"; // first | round-robin | least-used
+
+    int autoscaleMin = 0, autoscaleMax = 0; // --autoscale MIN:MAX; 0: fixed fleet
+    double waitSlo = 10; // --wait-slo: target p99 party wait, simulated seconds
+
+    // Headless batch mode: no status dump and no per-run event lines, only the final summary
+    bool quiet = false;
+    // --status summary: the status dump gives fleet totals instead of a line per instance
+    bool statusSummary = false;
+    bool metricsEnabled = false;
+    size_t logCapacity = 1 << 14; // records in the log ring
+};
+
+// One simulation: its parameters and every piece of its run state, so simulations share nothing and any number
+// can run side by side in one process. Configure, prepareSimulation, queue the time-0 players, runSimulation,
+// then read the results; a simulation runs once.
+struct Simulation : SimulationConfig {
+    atomic<uint64_t> rolePools[kMaxPools] = {}; // indexed by poolOf(region, band)
+    unique_ptr<PlayerQueue[]> playerQueues; // pools x kRoleCount, allocated once the region and band counts are known
+
+    TraceRecorder traceRecorder;
+    bool recording = false;
+    TraceReplay replay;
+
+    uint32_t nextPlayerId = 1; // producer-owned
+    Philox skillGen; // producer-owned, seeded by prepareSimulation
+    atomic<uint64_t> playersRejected{0}; // arrivals turned away because their role's field was full
+    atomic<uint64_t> playersShed[kRoleCount] = {}; // arrivals turned away at a queue cap
+    atomic<uint64_t> arrivalsHeld{0}; // arrivals the producer held back at a cap
+    double heldSeconds = 0; // simulated time they were held, in all; producer-owned
+
+    atomic<int> partyNum{1}; // next party number, claimed a pass at a time by the schedulers
+    atomic<bool> stopFlag{false};
+
+    // Streaming arrivals: while open the run never ends on an empty pool. Draining (SIGINT) closes arrivals, stops
+    // new assignments and lets running dungeons finish before the summary.
+    atomic<bool> arrivalsOpen{false};
+    atomic<bool> draining{false};
+
+    // Simulated clock in seconds: real-time backends read it off the wall clock since wallStart, the virtual-time
+    // backend jumps it from event to event
+    chrono::steady_clock::time_point wallStart;
+    atomic<double> virtualNow{0};
+
+    ArrivalProcess arrivals{replay};
+    mutex arrivalMutex;
+    condition_variable cv_arrivals;
+    atomic<bool> producerHeld{false}; // the real-time producer waits at a queue cap
+
+    LogSink logSink;
+    MetricsRegistry metrics;
+    // Simulated time of the latest completion, so the final report is not stretched by shutdown
+    atomic<double> lastCompletion{0};
+
+    InstanceArena instances;
+    vector<thread> instanceThreads; // threads backend: one per instance, kept out of the instance state
+    Region regionState[kMaxRegions];
+    atomic<int> busyCount{0};
+
+    int fleetAtStart = 0; // instances in service when the run starts, the lowest indices
+    atomic<int> activeInstances{0};
+    atomic<int> retireQuota{0}; // completions still to retire, set by the controller
+    AutoscaleStats autoscale; // the controller's
+
+    mutex poolMutex; // guards poolReady and poolTimers
+    condition_variable cv_pool;
+    TaskRing poolReady; // starts and fired completions, in order
+    TimerWheel poolTimers{instances, wallStart};
+    vector<thread> poolThreads;
+
+    // Wall time of the first wakeup request since the scheduler's last pass (0 = none pending)
+    atomic<int64_t> wakeRequestedNs{0};
+    MetricsExporter exporter{this};
+
+    Simulation() = default;
+
+    explicit Simulation(const SimulationConfig &config) : SimulationConfig(config) {}
+
+    Simulation(const Simulation &) = delete;
+
+    Simulation &operator=(const Simulation &) = delete;
+
+    // Player pools and party planning
+    int poolOf(int region, int band);
+    RoleCounts loadRoles(int pool);
+    RoleCounts loadRoles();
+    bool canFormParty(RoleCounts roles);
+    PartyPlan planParties(RoleCounts roles, const int fit[]);
+    PlayerQueue &playerQueue(int pool, int role);
+    int bandOf(int skill);
+    int queuedPlayers(Role role);
+    bool admissionRoom(Role role);
+    int regionOf(int ticket);
+    int addPlayers(Role role, int count, double now, int skill = -1);
+
+    double simNow();
+    chrono::steady_clock::time_point wallTimeAt(double simTime);
+    void wakeProducer();
+
+    void writeLog(const string &line);
+    void logLine(const string &line);
+    __attribute__((format(printf, 2, 3))) void logEvent(const char *format, ...);
+
+    // Fleet, regions and autoscaling
+    void releaseInstance(Instance &instance);
+    bool retireInstance(Instance &instance);
+    bool activateInstance(int region);
+    int getRandomTime(Instance &instance);
+    bool partyAvailable(int region);
+    bool partyAvailable();
+    bool regionFull(int region);
+    bool overloaded(int region);
+    bool regionMayPlace(int region);
+    bool anyInstanceBusy();
+    bool simulationDone();
+    void notifyScheduler(int region);
+    void notifySchedulers();
+    void ringSchedulers();
+    void autoscaleStep(double now);
+
+    // Runs, on every backend
+    int beginRun(Instance &instance, double now);
+    void endRun(Instance &instance);
+    void instanceThread(Instance *instance);
+    void armCompletion(Instance *instance, chrono::steady_clock::time_point due);
+    void startPooledRun(Instance *instance);
+    Lifecycle instanceLifecycle(Instance *instance);
+    void poolWorkerThread();
+    void dispatchParties(const vector<Instance *> &assigned);
+    int elapsedSeconds(const InstanceStatus &status);
+
+    // Forming parties
+    void takePlayers(int pool, const PartyPlan &plan, double now);
+    int takePlan(int pool, const PartyPlan &plan, double now, FreeInstances &free, vector<FormedParty> &formed);
+    double partyFormableAt(int pool, const PartyPlan &plan, int i);
+    int formableByBand(int base, const FreeInstances &free, int formable[], PartyPlan plans[] = nullptr);
+    int takeQuotas(int base, const int quota[], FreeInstances &free, double now, vector<FormedParty> &formed);
+
+    // Arrivals, shutdown and the schedulers
+    void closeArrivals();
+    void beginDrain();
+    void arrivalThread();
+    void shutdown();
+
+    template<typename Shard>
+    void runVirtual(vector<unique_ptr<Shard> > &shards);
+
+    template<typename Match, typename Select>
+    void runScheduler();
+
+    using SchedulerEntry = void (Simulation::*)();
+
+    template<typename Match>
+    SchedulerEntry schedulerWith(const string &select);
+
+    SchedulerEntry schedulerFor(const string &match, const string &select);
+
+    // Reports
+    void printMetrics(ostream &out, double elapsed);
+    void printEstimate(ostream &out);
+    void writeExport(ostream &out);
+    void writeInstanceExport(ostream &out);
+
+    bool prepareSimulation(int &n, string &error);
+    void runSimulation();
+    double runPoint(int n, int tanks, int healers, int dps, string &error);
+};
+
+inline int Simulation::poolOf(int region, int band) {
+    return region * skillBands + band;
+}
+
+inline RoleCounts Simulation::loadRoles(int pool) {
+    return unpackRoles(rolePools[pool].load(memory_order_acquire));
+}
+
+// Totals over every pool
+inline RoleCounts Simulation::loadRoles() {
+    RoleCounts total{0, 0, 0};
+    for (int pool = 0; pool < regions * skillBands; ++pool) {
+        RoleCounts roles = loadRoles(pool);
+        total.tanks += roles.tanks;
+        total.healers += roles.healers;
+        total.dps += roles.dps;
+    }
+    return total;
+}
+
+inline bool Simulation::canFormParty(RoleCounts roles) {
+    int left[kRoleCount] = {roles.tanks, roles.healers, roles.dps};
+    for (auto &kind: partyKinds)
+        if (fitCount(kind, left) > 0) return true;
+    return false;
+}
+
+// Choose party counts that seat the most players from roles within the instances fit[] allows each kind
+inline PartyPlan Simulation::planParties(RoleCounts roles, const int fit[]) {
+    int left[kRoleCount] = {roles.tanks, roles.healers, roles.dps};
+    if (partyKinds.size() == 1) {
+        PartyPlan plan;
+        plan.parties = plan.counts[0] = min(fitCount(partyKinds[0], left), fit[0]);
+        plan.players = plan.parties * partyKinds[0].size;
+        return plan;
+    }
+    PlanSearch search{partyKinds, fit};
+    search.search(0, left);
+    return search.best;
+}
+
+inline PlayerQueue &Simulation::playerQueue(int pool, int role) {
+    return playerQueues[pool * kRoleCount + role];
+}
+
+inline int Simulation::bandOf(int skill) {
+    return skill * skillBands / kSkillLevels;
+}
+
+inline int Simulation::queuedPlayers(Role role) {
+    int queued = 0;
+    for (int pool = 0; pool < regions * skillBands; ++pool)
+        queued += (int) ((rolePools[pool].load(memory_order_acquire) >> (role * kRoleBits)) & kRoleMask);
+    return queued;
+}
+
+inline bool Simulation::admissionRoom(Role role) {
+    return queuedPlayers(role) < queueCap[role];
+}
+
+// Home region of a player holding the given ticket in [0, regionWeightTotal)
+inline int Simulation::regionOf(int ticket) {
+    int region = 0;
+    while (ticket >= regionWeights[region]) ticket -= regionWeights[region++];
+    return region;
+}
+
+// Enqueue arriving players of one role at simulated time now (skill < 0 draws one per player) in the bands of
+// their home regions, saturating each pool at kMaxRoleCount and the role at its queue cap; returns how many were
+// accepted. Only the producer calls this, and schedulers only ever lower the counts, so the final adds cannot
+// overflow a field.
+inline int Simulation::addPlayers(Role role, int count, double now, int skill) {
+    if (recording) traceRecorder.record(TraceEvent::Arrival, now, role, count, skill);
+    int shift = role * kRoleBits, pools = regions * skillBands;
+    int queued[kMaxPools], added[kMaxPools] = {};
+    int total = 0;
+    for (int pool = 0; pool < pools; ++pool)
+        total += queued[pool] = (int) ((rolePools[pool].load(memory_order_acquire) >> shift) & kRoleMask);
+    int admitted = max(0, min(count, queueCap[role] - total));
+    if (admitted < count) playersShed[role].fetch_add(count - admitted, memory_order_relaxed);
+    count = admitted;
+
+    uniform_int_distribution<int> skillDist(0, kSkillLevels - 1), ticketDist(0, regionWeightTotal - 1);
+    int accepted = 0;
+    for (int i = 0; i < count; ++i) {
+        int playerSkill = skill >= 0 ? min(skill, kSkillLevels - 1) : skillDist(skillGen);
+        int pool = poolOf(regions > 1 ? regionOf(ticketDist(skillGen)) : 0, bandOf(playerSkill));
+        PlayerQueue &queue = playerQueue(pool, role);
+        if (queued[pool] + added[pool] >= kMaxRoleCount || queue.room() == 0) continue;
+        size_t slot = queue.tail++ & PlayerQueue::kMask;
+        queue.ids[slot] = nextPlayerId++;
+        queue.enqueuedAt[slot] = now;
+        queue.skills[slot] = (uint16_t) playerSkill;
+        added[pool]++;
+        accepted++;
+    }
+    for (int pool = 0; pool < pools; ++pool)
+        if (added[pool] > 0) rolePools[pool].fetch_add((uint64_t) added[pool] << shift, memory_order_acq_rel);
+    if (accepted < count) playersRejected.fetch_add(count - accepted, memory_order_relaxed);
+    return accepted;
+}
+
+inline double Simulation::simNow() {
+    if (backend == Backend::Virtual) return virtualNow.load(memory_order_relaxed);
+    return chrono::duration<double>(chrono::steady_clock::now() - wallStart).count() * timeScale;
+}
+
+inline chrono::steady_clock::time_point Simulation::wallTimeAt(double simTime) {
+    return wallStart + chrono::duration_cast<chrono::steady_clock::duration>(
+               chrono::duration<double>(simTime / timeScale));
+}
+
+// The schedulers took players or the fleet went idle: let a held producer recheck its cap
+inline void Simulation::wakeProducer() {
+    if (!admissionBlocks) return;
+    atomic_thread_fence(memory_order_seq_cst); // pairs with the producer's store before it checks the pools
+    if (!producerHeld.load(memory_order_relaxed)) return;
+    {
+        lock_guard<mutex> lock(arrivalMutex);
+    }
+    cv_arrivals.notify_all();
+}
+
+// Each line becomes one record; lines longer than a record are truncated
+inline void Simulation::writeLog(const string &line) {
+    size_t begin = 0;
+    while (begin < line.size()) {
+        size_t end = line.find('\n', begin);
+        end = end == string::npos ? line.size() : end + 1;
+        logSink.push(line.data() + begin, end - begin);
+        begin = end;
+    }
+}
+
+// Event and status output, silenced by --quiet
+inline void Simulation::logLine(const string &line) {
+    if (!quiet) writeLog(line);
+}
+
+// A per-run event line, formatted straight into a record-sized buffer on the stack; nothing is built when quiet
+inline void Simulation::logEvent(const char *format, ...) {
+    if (quiet) return;
+    char text[sizeof(LogRecord::text)];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof text, format, args);
+    va_end(args);
+    if (length > 0) logSink.push(text, min((size_t) length, sizeof text - 1));
+}
+
+inline void Simulation::releaseInstance(Instance &instance) {
+    atomic<int> &releasedHead = regionState[instance.region].releasedHead;
+    int head = releasedHead.load(memory_order_relaxed);
+    do {
+        instance.nextFree = head;
+    } while (!releasedHead.compare_exchange_weak(head, instance.id - 1, memory_order_release,
+                                                 memory_order_relaxed));
+}
+
+// Autoscaling (--autoscale MIN:MAX): the arena holds MAX instances and the controller keeps between MIN and MAX
+// of them in service, starting from --instances. The rest are parked in their regions; scaling up releases
+// parked instances to their region's scheduler, scaling down retires instances as their runs complete.
+// Called on completion: take the instance out of service if the controller asked for retirements, keeping one
+// per region so none is left without capacity
+inline bool Simulation::retireInstance(Instance &instance) {
+    int quota = retireQuota.load(memory_order_relaxed);
+    while (quota > 0 && !retireQuota.compare_exchange_weak(quota, quota - 1, memory_order_relaxed)) {
+    }
+    if (quota <= 0) return false;
+    Region &home = regionState[instance.region];
+    lock_guard<mutex> lock(home.scaleMutex);
+    if (home.size.load(memory_order_relaxed) <= 1) {
+        retireQuota.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    home.parked.push_back(instance.id - 1);
+    home.size.fetch_sub(1, memory_order_relaxed);
+    activeInstances.fetch_sub(1, memory_order_relaxed);
+    return true;
+}
+
+// Put the region's lowest parked instance in service; false when none is parked
+inline bool Simulation::activateInstance(int region) {
+    Region &home = regionState[region];
+    int index;
+    {
+        lock_guard<mutex> lock(home.scaleMutex);
+        if (home.parked.empty()) return false;
+        index = home.parked.back();
+        home.parked.pop_back();
+        home.size.fetch_add(1, memory_order_relaxed);
+    }
+    activeInstances.fetch_add(1, memory_order_relaxed);
+    releaseInstance(instances[index]);
+    return true;
+}
+
+// Random run time from the instance's class distribution, drawn from the instance's own stream (lock-free; an
+// instance starts one run at a time)
+inline int Simulation::getRandomTime(Instance &instance) {
+    if (replay.active()) {
+        int recorded = replay.durationOf(instance.partyId);
+        if (recorded >= 0) return recorded;
+    }
+    return instanceClasses[instance.instanceClass].duration.sample(instance.rng);
+}
+
+// Some band of the region can form a complete party
+inline bool Simulation::partyAvailable(int region) {
+    for (int band = 0; band < skillBands; ++band)
+        if (canFormParty(loadRoles(poolOf(region, band)))) return true;
+    return false;
+}
+
+// Some band of any region can
+inline bool Simulation::partyAvailable() {
+    for (int region = 0; region < regions; ++region)
+        if (partyAvailable(region)) return true;
+    return false;
+}
+
+inline bool Simulation::regionFull(int region) {
+    return regionState[region].busy.load(memory_order_acquire) >= regionState[region].size.load(memory_order_relaxed);
+}
+
+// A region others may steal from: every instance busy and a party still waiting
+inline bool Simulation::overloaded(int region) {
+    return regionFull(region) && partyAvailable(region);
+}
+
+// The region's scheduler may be able to place a party of its own or, stealing, one of an overloaded region's
+inline bool Simulation::regionMayPlace(int region) {
+    if (regionFull(region)) return false;
+    if (partyAvailable(region)) return true;
+    for (int other = 0; other < regions && stealing; ++other)
+        if (other != region && overloaded(other)) return true;
+    return false;
+}
+
+inline bool Simulation::anyInstanceBusy() {
+    return busyCount > 0;
+}
+
+// Nothing in flight, no more arrivals and no party can ever be placed
+inline bool Simulation::simulationDone() {
+    return !arrivalsOpen && !anyInstanceBusy() && (draining || !partyAvailable() || instances.empty());
+}
+
+// Called after a completion in the region. Only rings its scheduler on an edge (a party can be placed, or the
+// run may be over).
+inline void Simulation::notifyScheduler(int region) {
+    if (regionMayPlace(region) || !anyInstanceBusy()) {
+        if (metricsEnabled) {
+            int64_t none = 0;
+            wakeRequestedNs.compare_exchange_strong(none, wallNanos(), memory_order_relaxed);
+        }
+        regionState[region].bell.ring();
+    }
+}
+
+// After arrivals, which may have landed in any region
+inline void Simulation::notifySchedulers() {
+    for (int region = 0; region < regions; ++region) notifyScheduler(region);
+}
+
+inline void Simulation::ringSchedulers() {
+    for (int region = 0; region < regions; ++region) regionState[region].bell.ring();
+}
+
+// One autoscaling decision at simulated time now. Parties waiting while the p99 party wait since the last
+// decision misses the SLO (or none was assigned at all) add an instance per waiting party in their region; no
+// party waiting and a p99 well inside the SLO retire half the idle instances as runs complete.
+inline void Simulation::autoscaleStep(double now) {
+    HistogramSummary waits;
+    {
+        lock_guard<mutex> lock(metrics.m);
+        for (auto &shard: metrics.shards) waits.add(shard->partyWaitMs);
+    }
+    HistogramSummary window = waits.since(autoscale.seenWaits);
+    autoscale.seenWaits = waits;
+    double p99 = window.percentileUpper(0.99) / 1000.0; // scale on the bound, so a miss is never hidden by a bucket
+    int active = activeInstances.load(memory_order_relaxed);
+    autoscale.activeSeconds += active * (now - autoscale.lastAt);
+    autoscale.lastAt = now;
+
+    int unlimited[kMaxPartyKinds], waiting[kMaxRegions] = {}, totalWaiting = 0;
+    fill(unlimited, unlimited + kMaxPartyKinds, numeric_limits<int>::max());
+    for (int region = 0; region < regions; ++region) {
+        for (int band = 0; band < skillBands; ++band)
+            waiting[region] += planParties(loadRoles(poolOf(region, band)), unlimited).parties;
+        totalWaiting += waiting[region];
+    }
+
+    if (totalWaiting > 0 && (window.total == 0 || p99 > waitSlo)) {
+        retireQuota = 0;
+        for (int region = 0; region < regions; ++region) {
+            int added = 0;
+            while (added < waiting[region] && activeInstances.load(memory_order_relaxed) < autoscaleMax &&
+                   activateInstance(region))
+                added++;
+            autoscale.added += added;
+            if (added > 0) notifyScheduler(region);
+        }
+    } else if (totalWaiting == 0 && p99 <= waitSlo / 2) {
+        int idle = active - busyCount.load(memory_order_relaxed);
+        retireQuota = max(0, min((idle + 1) / 2, active - autoscaleMin));
+    }
+    autoscale.peak = max(autoscale.peak, activeInstances.load(memory_order_relaxed));
+}
+
+// Start the assigned party's run at simulated time now; shared by every backend. Returns the duration.
+inline int Simulation::beginRun(Instance &instance, double now) {
+    int duration = getRandomTime(instance);
+    {
+        TimedLock lock(metrics, instance.m, InstanceLock);
+        instance.running = true;
+        instance.currDungeonDuration = duration;
+        instance.runStart = now;
+        instance.publishStatus();
+    }
+    if (recording) traceRecorder.record(TraceEvent::Start, now, instance.id, instance.partyId, duration);
+    const char *content = partyKinds.size() > 1 ? partyKinds[instance.partyKind].name.c_str() : "dungeon";
+    logEvent("[Instance %d] Running %s for %d seconds.\n", instance.id, content, duration);
+    return duration;
+}
+
+inline void Simulation::endRun(Instance &instance) {
+    ScopedTimer timer(metrics, CompletionTimer);
+    {
+        TimedLock lock(metrics, instance.m, InstanceLock);
+        instance.running = false;
+        instance.hasParty = false;
+        instance.partiesServed++;
+        instance.totalTime += instance.currDungeonDuration;
+        instance.publishStatus();
+    }
+    if (recording)
+        traceRecorder.record(TraceEvent::Complete, instance.runStart + instance.currDungeonDuration, instance.id,
+                             instance.partyId, instance.currDungeonDuration);
+    double end = instance.runStart + instance.currDungeonDuration; // read before another run can start
+    if (!retireInstance(instance)) releaseInstance(instance);
+    regionState[instance.region].busy.fetch_sub(1, memory_order_acq_rel);
+    if (busyCount.fetch_sub(1, memory_order_acq_rel) == 1) wakeProducer();
+    if (metricsEnabled) {
+        MetricsShard::bump(metrics.local().runsCompleted);
+#ifdef DUNGEON_INSTRUMENT
+        runsEnded.fetch_add(1, memory_order_relaxed);
+#endif
+        double latest = lastCompletion.load(memory_order_relaxed);
+        while (end > latest && !lastCompletion.compare_exchange_weak(latest, end, memory_order_relaxed)) {
+        }
+    }
+
+    logEvent("[Instance %d] Dungeon completed.\n", instance.id);
+
+    notifyScheduler(instance.region);
+}
+
+// Thread function for each dungeon instance
+inline void Simulation::instanceThread(Instance *instance) {
+    while (!stopFlag) {
+        instance->bell.wait(metrics, InstanceCv, [&]() {
+            TimedLock lock(metrics, instance->m, InstanceLock);
+            return instance->hasParty || stopFlag;
+        });
+
+        if (stopFlag) break;
+
+        int duration = beginRun(*instance, simNow());
+        this_thread::sleep_until(wallTimeAt(instance->runStart + duration)); // one wakeup per run
+        endRun(*instance);
+    }
+}
+
+// Wakes a worker only when the new timer moved the wheel's next deadline earlier
+inline void Simulation::armCompletion(Instance *instance, chrono::steady_clock::time_point due) {
+    bool earlier;
+    {
+        TimedLock lock(metrics, poolMutex, PoolLock);
+        int64_t before = poolTimers.nextDue();
+        poolTimers.add(instance->id - 1, poolTimers.tickOf(due, true));
+        earlier = poolTimers.nextDue() < before;
+    }
+    if (earlier) cv_pool.notify_one();
+}
+
+// Pool backend: begin the run and arm its completion instead of sleeping through it
+inline void Simulation::startPooledRun(Instance *instance) {
+    double now = simNow();
+    int duration = beginRun(*instance, now);
+    armCompletion(instance, wallTimeAt(now + duration));
+}
+
+// Coroutine backend: each instance's lifecycle is one coroutine (a frame of a few hundred bytes, no stack of its
+// own). Pool workers resume it from the same ready queue and timer wheel as pooled runs: a start task resumes it
+// with a party, a fired completion when its run is over. It suspends before it hands itself back, so only the
+// worker that pops its next task can resume it.
+struct Lifecycle {
+    struct promise_type {
+        Lifecycle get_return_object() { return {coroutine_handle<promise_type>::from_promise(*this)}; }
+        suspend_always initial_suspend() noexcept { return {}; } // until the first party
+        suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+
+    coroutine_handle<promise_type> handle;
+};
+
+// Suspends for the run; resumed by the completion timer armed once suspended
+struct RunTimer {
+    Simulation *sim;
+    Instance *instance;
+    chrono::steady_clock::time_point due;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coroutine_handle<>) const { sim->armCompletion(instance, due); }
+    void await_resume() const noexcept {}
+};
+
+// Reports the completion and so frees the instance, once suspended; resumed with the next party
+struct NextParty {
+    Simulation *sim;
+    Instance *instance;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coroutine_handle<>) const { sim->endRun(*instance); }
+    void await_resume() const noexcept {}
+};
+
+// Never returns; destroyed suspended when the run ends
+inline Lifecycle Simulation::instanceLifecycle(Instance *instance) {
+    for (;;) {
+        double now = simNow();
+        int duration = beginRun(*instance, now);
+        co_await RunTimer{this, instance, wallTimeAt(now + duration)};
+        co_await NextParty{this, instance};
+    }
+}
+
+// Pool worker: fires due timers, then runs ready tasks; the wheel's next tick bounds how long it sleeps
+inline void Simulation::poolWorkerThread() {
+    unique_lock<mutex> lock(poolMutex);
+    while (!stopFlag) {
+        if (poolReady.empty() && poolTimers.pending > 0)
+            poolTimers.advance(poolTimers.tickOf(chrono::steady_clock::now(), false), [this](int index) {
+                poolReady.push_back({&instances[index], true});
+            });
+        if (poolReady.empty()) {
+            if (poolTimers.pending == 0) {
+                cvWait(metrics, cv_pool, lock, PoolCv, [this] {
+                    return stopFlag || !poolReady.empty() || poolTimers.pending > 0;
+                });
+                continue;
+            }
+            int64_t due = poolTimers.nextDue();
+            cvWaitUntil(metrics, cv_pool, lock, poolTimers.timeOf(due), PoolCv, [this, due] {
+                return stopFlag || !poolReady.empty() || poolTimers.nextDue() < due;
+            });
+            continue;
+        }
+
+        PoolTask task = poolReady.pop_front();
+        lock.unlock();
+
+        if (backend == Backend::Coroutine) task.instance->lifecycle.resume();
+        else if (task.completion) endRun(*task.instance);
+        else startPooledRun(task.instance);
+
+        relock(metrics, lock, PoolLock);
+    }
+}
+
+// Hand freshly assigned parties to whichever backend drives the instances
+inline void Simulation::dispatchParties(const vector<Instance *> &assigned) {
+    if (backend == Backend::Pool || backend == Backend::Coroutine) {
+        {
+            TimedLock lock(metrics, poolMutex, PoolLock);
+            for (auto &instance: assigned)
+                poolReady.push_back({instance, false});
+        }
+        // One worker per start, not the whole pool
+        size_t wake = min(assigned.size(), poolThreads.size());
+        for (size_t i = 0; i < wake; ++i)
+            cv_pool.notify_one();
+    } else {
+        for (auto &instance: assigned)
+            instance->bell.ring();
+    }
+}
+
+// Progress of a running instance, from its start time
+inline int Simulation::elapsedSeconds(const InstanceStatus &status) {
+    return min(status.currDungeonDuration, (int) (simNow() - status.runStart));
+}
+
+// Take the players a plan covers off one pool's queue fronts, kind by kind; each party takes the next `need`
+// players of every role and became formable when its last member queued.
+inline void Simulation::takePlayers(int pool, const PartyPlan &plan, double now) {
+    size_t heads[kRoleCount];
+    for (int role = 0; role < kRoleCount; ++role)
+        heads[role] = playerQueue(pool, role).head.load(memory_order_relaxed);
+
+    MetricsShard *shard = metricsEnabled ? &metrics.local() : nullptr;
+    if (shard) MetricsShard::bump(shard->partiesFormed, plan.parties);
+    for (size_t kind = 0; kind < partyKinds.size(); ++kind) {
+        const PartyKind &party = partyKinds[kind];
+        if (!shard) {
+            for (int role = 0; role < kRoleCount; ++role)
+                heads[role] += (size_t) plan.counts[kind] * party.need[role];
+            continue;
+        }
+        MetricsShard::bump(shard->partiesByKind[kind], plan.counts[kind]);
+        for (int i = 0; i < plan.counts[kind]; ++i) {
+            double formable = 0;
+            for (int role = 0; role < kRoleCount; ++role) {
+                for (int k = 0; k < party.need[role]; ++k) {
+                    double queuedAt = playerQueue(pool, role).enqueuedAt[heads[role]++ & PlayerQueue::kMask];
+                    shard->playerWaitMs.record((uint64_t) ((now - queuedAt) * 1000));
+                    formable = max(formable, queuedAt);
+                }
+            }
+            shard->partyWaitMs.record((uint64_t) ((now - formable) * 1000));
+        }
+    }
+
+    for (int role = 0; role < kRoleCount; ++role)
+        playerQueue(pool, role).head.store(heads[role], memory_order_release);
+}
+
+// Free instances per class while a pass plans. A party takes the smallest class that fits it, so larger
+// instances stay free for larger parties.
+struct FreeInstances {
+    const Simulation &sim;
+    int perClass[kMaxInstanceClasses] = {};
+
+    int total() const {
+        int free = 0;
+        for (size_t c = 0; c < sim.instanceClasses.size(); ++c) free += perClass[c];
+        return free;
+    }
+
+    int fitting(const PartyKind &kind) const {
+        int free = 0;
+        for (size_t c = 0; c < sim.instanceClasses.size(); ++c)
+            if (sim.instanceClasses[c].capacity >= kind.size) free += perClass[c];
+        return free;
+    }
+
+    // Instances open to each kind, for planParties, with at most maxParties parties in all
+    void limits(int fit[], int maxParties) const {
+        for (size_t kind = 0; kind < sim.partyKinds.size(); ++kind)
+            fit[kind] = min(fitting(sim.partyKinds[kind]), maxParties);
+    }
+
+    int take(const PartyKind &kind) {
+        int best = -1;
+        for (size_t c = 0; c < sim.instanceClasses.size(); ++c)
+            if (perClass[c] > 0 && sim.instanceClasses[c].capacity >= kind.size &&
+                (best < 0 || sim.instanceClasses[c].capacity < sim.instanceClasses[best].capacity))
+                best = (int) c;
+        perClass[best]--;
+        return best;
+    }
+};
+
+// A party formed this pass and the class of instance it was routed to
+struct FormedParty {
+    int kind;
+    int instanceClass;
+};
+
+// Reserve and take a plan's players and route its parties, largest first. The plan was made from a load of the
+// pool and only its region's scheduler (or, with --steal, whoever holds the region's takeMutex) lowers it, so
+// the plan still fits; planParties kept it within the free instances, so routing cannot run out.
+inline int Simulation::takePlan(int pool, const PartyPlan &plan, double now, FreeInstances &free,
+                                vector<FormedParty> &formed) {
+    if (plan.parties == 0) return 0;
+    uint64_t cost = 0;
+    for (size_t kind = 0; kind < partyKinds.size(); ++kind) cost += plan.counts[kind] * partyKinds[kind].cost;
+    rolePools[pool].fetch_sub(cost, memory_order_acq_rel);
+    wakeProducer();
+    takePlayers(pool, plan, now);
+    for (size_t kind = 0; kind < partyKinds.size(); ++kind)
+        for (int i = 0; i < plan.counts[kind]; ++i) formed.push_back({(int) kind, free.take(partyKinds[kind])});
+    return plan.parties;
+}
+
+// When the i-th party of a plan for the pool became complete: the latest enqueue time among its members, taken
+// kind by kind as takePlayers does. Infinite past the plan's parties, whose members may not have queued.
+inline double Simulation::partyFormableAt(int pool, const PartyPlan &plan, int i) {
+    if (i >= plan.parties) return numeric_limits<double>::infinity();
+    size_t taken[kRoleCount] = {}; // members of each role the plan's earlier kinds take
+    size_t kind = 0;
+    while (i >= plan.counts[kind]) {
+        for (int role = 0; role < kRoleCount; ++role)
+            taken[role] += (size_t) plan.counts[kind] * partyKinds[kind].need[role];
+        i -= plan.counts[kind++];
+    }
+    const PartyKind &party = partyKinds[kind];
+    double formable = 0;
+    for (int role = 0; role < kRoleCount; ++role) {
+        if (party.need[role] == 0) continue;
+        PlayerQueue &queue = playerQueue(pool, role);
+        size_t last = queue.head.load(memory_order_relaxed) + taken[role] + (size_t) (i + 1) * party.need[role] - 1;
+        formable = max(formable, queue.enqueuedAt[last & PlayerQueue::kMask]);
+    }
+    return formable;
+}
+
+// Parties each band of the region whose first pool is base could form on its own from the free instances,
+// returning the total; plans, if given, gets each band's plan
+inline int Simulation::formableByBand(int base, const FreeInstances &free, int formable[], PartyPlan plans[]) {
+    int fit[kMaxPartyKinds], total = 0;
+    free.limits(fit, numeric_limits<int>::max());
+    for (int band = 0; band < skillBands; ++band) {
+        PartyPlan plan = planParties(loadRoles(base + band), fit);
+        total += formable[band] = plan.parties;
+        if (plans) plans[band] = plan;
+    }
+    return total;
+}
+
+// Form up to quota[band] parties from each band in turn, each planned against the instances still free
+inline int Simulation::takeQuotas(int base, const int quota[], FreeInstances &free, double now,
+                                  vector<FormedParty> &formed) {
+    int count = 0;
+    for (int band = 0; band < skillBands; ++band) {
+        if (quota[band] == 0) continue;
+        int fit[kMaxPartyKinds];
+        free.limits(fit, quota[band]);
+        count += takePlan(base + band, planParties(loadRoles(base + band), fit), now, free, formed);
+    }
+    return count;
+}
+
+// Party composition policies. formParties(free, now, formed) picks how many parties each band of the region
+// contributes from the free instances, takes and routes them, appends them to formed and returns how many
+// formed. base is the region's first pool.
+
+// FIFO: skill is ignored (a single band), parties form in arrival order
+struct FifoMatch {
+    Simulation *sim = nullptr;
+    int base = 0;
+
+    int formParties(FreeInstances &free, double now, vector<FormedParty> &formed) {
+        int fit[kMaxPartyKinds];
+        free.limits(fit, numeric_limits<int>::max());
+        return sim->takePlan(base, sim->planParties(sim->loadRoles(base), fit), now, free, formed);
+    }
+};
+
+// Skill-banded: a party never mixes bands; scarce instances are dealt out to bands in turn, rotating which band
+// is dealt first so none is starved
+struct SkillBandedMatch {
+    Simulation *sim = nullptr;
+    int base = 0;
+    int firstBand = 0;
+
+    int formParties(FreeInstances &free, double now, vector<FormedParty> &formed) {
+        int formable[kMaxSkillBands], quota[kMaxSkillBands] = {};
+        int maxParties = free.total();
+        if (sim->formableByBand(base, free, formable) <= maxParties)
+            return sim->takeQuotas(base, formable, free, now, formed);
+
+        for (int dealt = 0; dealt < maxParties;) {
+            for (int i = 0; i < sim->skillBands && dealt < maxParties; ++i) {
+                int band = (firstBand + i) % sim->skillBands;
+                if (quota[band] < formable[band]) {
+                    quota[band]++;
+                    dealt++;
+                }
+            }
+        }
+        firstBand = (firstBand + 1) % sim->skillBands;
+        return sim->takeQuotas(base, quota, free, now, formed);
+    }
+};
+
+// Longest-wait-first: bands as above, but scarce instances go to the parties that became formable earliest
+struct LongestWaitMatch {
+    Simulation *sim = nullptr;
+    int base = 0;
+
+    int formParties(FreeInstances &free, double now, vector<FormedParty> &formed) {
+        int formable[kMaxSkillBands], quota[kMaxSkillBands] = {};
+        PartyPlan plans[kMaxSkillBands];
+        int maxParties = free.total();
+        if (sim->formableByBand(base, free, formable, plans) <= maxParties)
+            return sim->takeQuotas(base, formable, free, now, formed);
+
+        // Ranked by the parties each band's planner would form, in the order it takes them
+        for (int dealt = 0; dealt < maxParties; ++dealt) {
+            int oldest = -1;
+            double oldestAt = numeric_limits<double>::infinity();
+            for (int band = 0; band < sim->skillBands; ++band) {
+                if (quota[band] == formable[band]) continue;
+                double at = sim->partyFormableAt(base + band, plans[band], quota[band]);
+                if (at < oldestAt) {
+                    oldestAt = at;
+                    oldest = band;
+                }
+            }
+            quota[oldest]++;
+        }
+        return sim->takeQuotas(base, quota, free, now, formed);
+    }
+};
+
+// Instance selection policies over the scheduler's private free set of instance indices
+
+// Most recently freed first, while its state is still warm in cache; intrusive stack through Instance::nextFree
+struct FirstFreeSelect {
+    Instance *instances = nullptr; // the arena the indices are into
+    int head = -1;
+    int count = 0;
+
+    void fill(Instance *fleet, const vector<int> &members) {
+        instances = fleet;
+        for (auto it = members.rbegin(); it != members.rend(); ++it) push(*it); // lowest id on top, filled first
+    }
+
+    void push(int index) {
+        instances[index].nextFree = head;
+        head = index;
+        count++;
+    }
+
+    int pop() {
+        int index = head;
+        head = instances[index].nextFree;
+        count--;
+        return index;
+    }
+
+    int size() const { return count; }
+};
+
+// Longest idle first, spreading runs evenly over the fleet; intrusive FIFO through Instance::nextFree
+struct RoundRobinSelect {
+    Instance *instances = nullptr;
+    int head = -1;
+    int tail = -1;
+    int count = 0;
+
+    void fill(Instance *fleet, const vector<int> &members) {
+        instances = fleet;
+        for (int index: members) push(index);
+    }
+
+    void push(int index) {
+        instances[index].nextFree = -1;
+        if (tail == -1) head = index;
+        else instances[tail].nextFree = index;
+        tail = index;
+        count++;
+    }
+
+    int pop() {
+        int index = head;
+        head = instances[index].nextFree;
+        if (head == -1) tail = -1;
+        count--;
+        return index;
+    }
+
+    int size() const { return count; }
+};
+
+// Least accumulated busy time first, evening out utilization; a binary heap reserved once up front
+struct LeastUsedSelect {
+    Instance *instances = nullptr;
+    vector<pair<int, int> > heap; // (totalTime, index)
+
+    void fill(Instance *fleet, const vector<int> &members) {
+        instances = fleet;
+        heap.reserve(members.size());
+        for (int index: members) push(index);
+    }
+
+    void push(int index) {
+        heap.push_back({instances[index].totalTime, index});
+        push_heap(heap.begin(), heap.end(), greater<>());
+    }
+
+    int pop() {
+        pop_heap(heap.begin(), heap.end(), greater<>());
+        int index = heap.back().second;
+        heap.pop_back();
+        return index;
+    }
+
+    int size() const { return (int) heap.size(); }
+};
+
+// Stop accepting arrivals; the scheduler may now be able to finish
+inline void Simulation::closeArrivals() {
+    {
+        lock_guard<mutex> lock(arrivalMutex);
+        arrivalsOpen = false;
+    }
+    cv_arrivals.notify_all();
+    ringSchedulers();
+}
+
+inline void Simulation::beginDrain() {
+    draining = true;
+    closeArrivals();
+}
+
+// Real-time producer stage: sleeps until each arrival is due and feeds it into the pool
+inline void Simulation::arrivalThread() {
+    Arrival arrival{};
+    unique_lock<mutex> lock(arrivalMutex);
+    while (arrivalsOpen && arrivals.next(arrival)) {
+        if (cvWaitUntil(metrics, cv_arrivals, lock, wallTimeAt(arrival.time), ArrivalCv, [this] {
+            return !arrivalsOpen;
+        }))
+            break;
+        double at = arrival.time;
+        if (admissionBlocks && !admissionRoom(arrival.role)) {
+            // Held at the cap while the fleet can still make room; an idle fleet with no party to form never will
+            producerHeld = true;
+            cvWait(metrics, cv_arrivals, lock, ArrivalCv, [&] {
+                return !arrivalsOpen || admissionRoom(arrival.role) || (!anyInstanceBusy() && !partyAvailable());
+            });
+            producerHeld = false;
+            if (!arrivalsOpen) break;
+            at = max(at, simNow());
+            arrivalsHeld.fetch_add(1, memory_order_relaxed);
+            heldSeconds += at - arrival.time;
+        }
+        lock.unlock();
+        if (addPlayers(arrival.role, arrival.count, at, arrival.skill) > 0) notifySchedulers();
+        lock.lock();
+    }
+    lock.unlock();
+    closeArrivals();
+}
+
+inline void Simulation::shutdown() {
+    stopFlag = true;
+    for (auto &inst: instances)
+        inst.bell.ring(); // a futex wake only for instance threads actually parked
+    ringSchedulers();
+    {
+        lock_guard<mutex> poolLock(poolMutex);
+    }
+    cv_pool.notify_all();
+}
+
+// The scheduler, specialized at compile time on a party composition policy and an instance selection policy so
+// neither costs an indirect call on the hot path. There is one per region; it owns a free set per instance class
+// of the region's instances, and completions hand instances back through the region's released stack.
+template<typename Match, typename Select>
+struct Scheduler {
+    Simulation &sim;
+    int region;
+    Match match;
+    Select select[kMaxInstanceClasses];
+    vector<Instance *> batch;
+    vector<FormedParty> formed; // kind and route of each batch entry
+
+    Scheduler(Simulation &sim_, int region_) : sim(sim_), region(region_) {
+        match.sim = &sim;
+        match.base = sim.poolOf(region, 0);
+        // The region's whole share of the arena, parked instances included, so passes never grow these
+        batch.reserve(sim.instances.size() / sim.regions + 1);
+        formed.reserve(sim.instances.size() / sim.regions + 1);
+        vector<int> members;
+        for (size_t c = 0; c < sim.instanceClasses.size(); ++c) {
+            members.clear();
+            for (auto &inst: sim.instances)
+                if (inst.region == region && inst.instanceClass == (int) c && inst.id <= sim.fleetAtStart)
+                    members.push_back(inst.id - 1);
+            select[c].fill(sim.instances.begin(), members);
+        }
+    }
+
+    void collectReleased() {
+        int head = sim.regionState[region].releasedHead.exchange(-1, memory_order_acquire);
+        while (head != -1) {
+            int next = sim.instances[head].nextFree;
+            select[sim.instances[head].instanceClass].push(head);
+            head = next;
+        }
+    }
+
+    FreeInstances freeInstances() const {
+        FreeInstances free{sim};
+        for (size_t c = 0; c < sim.instanceClasses.size(); ++c) free.perClass[c] = select[c].size();
+        return free;
+    }
+
+    // Some band of the region, or of an overloaded one when stealing, can fill a party that a free instance is
+    // big enough for
+    bool canPlace() {
+        collectReleased();
+        FreeInstances free = freeInstances();
+        for (int other = 0; other < sim.regions; ++other) {
+            if (other != region && !(sim.stealing && sim.overloaded(other))) continue;
+            for (int band = 0; band < sim.skillBands; ++band) {
+                RoleCounts roles = sim.loadRoles(sim.poolOf(other, band));
+                int left[kRoleCount] = {roles.tanks, roles.healers, roles.dps};
+                for (auto &kind: sim.partyKinds)
+                    if (fitCount(kind, left) > 0 && free.fitting(kind) > 0) return true;
+            }
+        }
+        return false;
+    }
+
+    // Instances still free after the region's own parties: take parties from overloaded regions, nearest
+    // first, band by band, planned against what is left
+    int stealParties(FreeInstances &free, double now) {
+        int stolen = 0;
+        for (int step = 1; step < sim.regions && free.total() > 0; ++step) {
+            int victim = (region + step) % sim.regions;
+            if (!sim.overloaded(victim)) continue;
+            TimedLock take(sim.metrics, sim.regionState[victim].takeMutex, RegionLock);
+            for (int band = 0; band < sim.skillBands && free.total() > 0; ++band) {
+                int fit[kMaxPartyKinds], pool = sim.poolOf(victim, band);
+                free.limits(fit, numeric_limits<int>::max());
+                stolen += sim.takePlan(pool, sim.planParties(sim.loadRoles(pool), fit), now, free, formed);
+            }
+        }
+        return stolen;
+    }
+
+    // One scheduling pass shared by every backend: form every party the region's pools and its free instances
+    // allow, then with --steal fill what is left from overloaded regions
+    int assignParties() {
+        ScopedTimer timer(sim.metrics, AssignPassTimer);
+        batch.clear();
+        formed.clear();
+        if (sim.draining) return 0;
+        collectReleased();
+        FreeInstances free = freeInstances();
+        double now = sim.simNow();
+        int parties, stolen = 0;
+        if (sim.stealing) {
+            {
+                TimedLock take(sim.metrics, sim.regionState[region].takeMutex, RegionLock);
+                parties = match.formParties(free, now, formed);
+            }
+            if (free.total() > 0) parties += stolen = stealParties(free, now);
+        } else {
+            parties = match.formParties(free, now, formed);
+        }
+        if (parties == 0) return 0;
+
+        int firstParty = sim.partyNum.fetch_add(parties, memory_order_relaxed);
+        sim.busyCount.fetch_add(parties, memory_order_acq_rel);
+        Region &home = sim.regionState[region];
+        home.busy.fetch_add(parties, memory_order_acq_rel);
+        home.formed.fetch_add(parties, memory_order_relaxed);
+        if (stolen) home.stolen.fetch_add(stolen, memory_order_relaxed);
+
+        for (int i = 0; i < parties; ++i) {
+            Instance *instance = &sim.instances[select[formed[i].instanceClass].pop()];
+            {
+                TimedLock instanceLock(sim.metrics, instance->m, InstanceLock);
+                instance->hasParty = true;
+                instance->partyKind = formed[i].kind;
+                instance->partyId = firstParty + i;
+                instance->publishStatus();
+            }
+            if (sim.recording) sim.traceRecorder.record(TraceEvent::Assign, now, instance->id, firstParty + i, 0);
+            batch.push_back(instance);
+        }
+
+        // Now full with parties still waiting: wake the regions that could take them
+        if (sim.stealing && free.total() == 0 && sim.partyAvailable(region))
+            for (int other = 0; other < sim.regions; ++other)
+                if (other != region && !sim.regionFull(other)) sim.regionState[other].bell.ring();
+        return parties;
+    }
+
+    // Dedicated scheduler thread: sleeps until an assignment or shutdown becomes possible
+    void runThreaded() {
+        while (true) {
+            sim.regionState[region].bell.wait(sim.metrics, SchedulerCv, [&]() {
+                return sim.stopFlag || (!sim.draining && canPlace()) || sim.simulationDone();
+            });
+
+            if (sim.stopFlag) break;
+
+            int64_t passStart = sim.metricsEnabled ? wallNanos() : 0;
+            if (assignParties() > 0) {
+                sim.dispatchParties(batch);
+                if (sim.metricsEnabled) {
+                    int64_t requested = sim.wakeRequestedNs.exchange(0, memory_order_relaxed);
+                    sim.metrics.local().assignLatencyNs.record(wallNanos() - (requested ? requested : passStart));
+                }
+            }
+
+            if (sim.simulationDone()) {
+                sim.shutdown();
+                break;
+            }
+        }
+    }
+};
+
+// Virtual-time backend: the same scheduling passes, region by region, and run logic on one thread, driven from
+// a queue of completion events keyed on the simulated clock. Ties complete in instance order so a run is
+// reproducible.
+template<typename Shard>
+void Simulation::runVirtual(vector<unique_ptr<Shard> > &shards) {
+    vector<pair<double, int> > pending;
+    pending.reserve(instances.size()); // one completion per instance at most
+    priority_queue<pair<double, int>, vector<pair<double, int> >, greater<> > completions(greater<>(), move(pending));
+
+    Arrival arrival{};
+    bool haveArrival = arrivalsOpen && arrivals.next(arrival);
+    bool arrivalHeld = false; // the pending arrival has waited at a cap
+    double nextControl = kControlInterval;
+
+    while (!stopFlag) {
+        if (interruptRequested && !draining) beginDrain();
+        if (!arrivalsOpen) haveArrival = false;
+
+        double now = virtualNow.load(memory_order_relaxed);
+        for (auto &shard: shards) {
+            int64_t passStart = metricsEnabled ? wallNanos() : 0;
+            if (shard->assignParties() > 0 && metricsEnabled)
+                metrics.local().assignLatencyNs.record(wallNanos() - passStart); // no wakeups here, just the pass
+            for (auto &instance: shard->batch)
+                completions.push({now + beginRun(*instance, now), instance->id - 1});
+        }
+
+        if (!haveArrival && arrivalsOpen) closeArrivals();
+        if (completions.empty() && !haveArrival) break;
+
+        // At a cap with --admission block an arrival waits for the next completion, when a pass can take players;
+        // with nothing running none ever would, and the cap sheds it instead
+        bool held = haveArrival && admissionBlocks && !completions.empty() && !admissionRoom(arrival.role);
+        arrivalHeld = arrivalHeld || held;
+        // Autoscaling decides between events, once a simulated interval
+        if (autoscaleMax > 0) {
+            double next = completions.empty() ? numeric_limits<double>::infinity() : completions.top().first;
+            if (haveArrival && !held) next = min(next, max(arrival.time, now));
+            if (nextControl <= next) {
+                if (paced) this_thread::sleep_until(wallTimeAt(nextControl));
+                virtualNow.store(nextControl, memory_order_relaxed);
+                autoscaleStep(nextControl);
+                nextControl += kControlInterval;
+                continue;
+            }
+        }
+        // Arrivals at the same instant as a completion go first so the freed instance can take them
+        if (haveArrival && !held && (completions.empty() || arrival.time <= completions.top().first)) {
+            double at = max(arrival.time, now);
+            if (paced) this_thread::sleep_until(wallTimeAt(at));
+            virtualNow.store(at, memory_order_relaxed);
+            if (arrivalHeld) {
+                arrivalsHeld.fetch_add(1, memory_order_relaxed);
+                heldSeconds += at - arrival.time;
+            }
+            addPlayers(arrival.role, arrival.count, at, arrival.skill);
+            haveArrival = arrivals.next(arrival);
+            arrivalHeld = false;
+            continue;
+        }
+
+        auto [due, index] = completions.top();
+        completions.pop();
+        if (paced) this_thread::sleep_until(wallTimeAt(due));
+        virtualNow.store(due, memory_order_relaxed);
+        endRun(instances[index]);
+    }
+    shutdown();
+}
+
+// One scheduler per region; threaded backends run each on a thread of its own
+template<typename Match, typename Select>
+void Simulation::runScheduler() {
+    vector<unique_ptr<Scheduler<Match, Select> > > shards;
+    for (int region = 0; region < regions; ++region)
+        shards.push_back(make_unique<Scheduler<Match, Select> >(*this, region));
+    if (backend == Backend::Virtual) {
+        runVirtual(shards);
+        return;
+    }
+    vector<thread> others;
+    for (int region = 1; region < regions; ++region)
+        others.emplace_back(&Scheduler<Match, Select>::runThreaded, shards[region].get());
+    shards[0]->runThreaded();
+    for (auto &other: others) other.join();
+}
+
+template<typename Match>
+Simulation::SchedulerEntry Simulation::schedulerWith(const string &select) {
+    if (select == "round-robin") return &Simulation::runScheduler<Match, RoundRobinSelect>;
+    if (select == "least-used") return &Simulation::runScheduler<Match, LeastUsedSelect>;
+    return &Simulation::runScheduler<Match, FirstFreeSelect>;
+}
+
+inline Simulation::SchedulerEntry Simulation::schedulerFor(const string &match, const string &select) {
+    if (match == "lwf") return schedulerWith<LongestWaitMatch>(select);
+    if (match == "skill") return schedulerWith<SkillBandedMatch>(select);
+    return schedulerWith<FifoMatch>(select);
+}
+
+// Report as of simulated time elapsed: on demand that is now, at the end the last completion
+inline void Simulation::printMetrics(ostream &out, double elapsed) {
+    HistogramSummary waits, playerWaits, latencies;
+#ifdef DUNGEON_INSTRUMENT
+    HistogramSummary lockWaits[kLockSites], lockHolds[kLockSites], timers[kTimerSites];
+    uint64_t cvWaits[kCvSites] = {}, cvWakeups[kCvSites] = {}, cvSpurious[kCvSites] = {};
+#endif
+    uint64_t parties = 0, completed = 0, byKind[kMaxPartyKinds] = {};
+    {
+        lock_guard<mutex> lock(metrics.m);
+        for (auto &shard: metrics.shards) {
+            waits.add(shard->partyWaitMs);
+            playerWaits.add(shard->playerWaitMs);
+            latencies.add(shard->assignLatencyNs);
+#ifdef DUNGEON_INSTRUMENT
+            for (int site = 0; site < kLockSites; ++site) {
+                lockWaits[site].add(shard->lockWaitNs[site]);
+                lockHolds[site].add(shard->lockHoldNs[site]);
+            }
+            for (int site = 0; site < kCvSites; ++site) {
+                cvWaits[site] += shard->cvWaits[site].load(memory_order_relaxed);
+                cvWakeups[site] += shard->cvWakeups[site].load(memory_order_relaxed);
+                cvSpurious[site] += shard->cvSpurious[site].load(memory_order_relaxed);
+            }
+            for (int site = 0; site < kTimerSites; ++site) timers[site].add(shard->timerNs[site]);
+#endif
+            parties += shard->partiesFormed.load(memory_order_relaxed);
+            completed += shard->runsCompleted.load(memory_order_relaxed);
+            for (size_t kind = 0; kind < partyKinds.size(); ++kind)
+                byKind[kind] += shard->partiesByKind[kind].load(memory_order_relaxed);
+        }
+    }
+    out << "\n=== Metrics (at " << elapsed << " simulated seconds) ===\n";
+    out << "Parties formed: " << parties << ", runs completed: " << completed << ", "
+            << (elapsed > 0 ? (double) parties / elapsed : 0.0) << " parties per second\n";
+    if (partyKinds.size() > 1) {
+        out << "Parties by kind:";
+        for (size_t kind = 0; kind < partyKinds.size(); ++kind)
+            out << (kind ? ", " : " ") << partyKinds[kind].name << " " << byKind[kind];
+        out << "\n";
+    }
+    out << "Party wait (s): p50 " << waits.percentile(0.5) / 1000.0 << ", p99 " << waits.percentile(0.99) / 1000.0
+            << ", max " << waits.maxValue / 1000.0 << "\n";
+    out << "Player wait (s): p50 " << playerWaits.percentile(0.5) / 1000.0 << ", p99 "
+            << playerWaits.percentile(0.99) / 1000.0 << ", max " << playerWaits.maxValue / 1000.0 << "\n";
+    out << "Assignment latency (us): p50 " << latencies.percentile(0.5) / 1000.0 << ", p99 "
+            << latencies.percentile(0.99) / 1000.0 << ", max " << latencies.maxValue / 1000.0 << "\n";
+#ifdef DUNGEON_INSTRUMENT
+    for (int site = 0; site < kLockSites; ++site) {
+        const HistogramSummary &wait = lockWaits[site], &hold = lockHolds[site];
+        out << "Lock " << kLockSiteNames[site] << " (ns): " << wait.total << " acquisitions, wait p50 "
+                << wait.percentile(0.5) << ", p99 " << wait.percentile(0.99) << ", max " << wait.maxValue
+                << "; hold p50 " << hold.percentile(0.5) << ", p99 " << hold.percentile(0.99) << ", max "
+                << hold.maxValue << "\n";
+    }
+    for (int site = 0; site < kCvSites; ++site)
+        out << "Wait " << kCvSiteNames[site] << ": " << cvWaits[site] << " waits, " << cvWakeups[site]
+                << " wakeups, " << cvSpurious[site] << " spurious\n";
+    for (int site = 0; site < kTimerSites; ++site)
+        out << "Timer " << kTimerSiteNames[site] << " (ns): " << timers[site].total << " calls, p50 "
+                << timers[site].percentile(0.5) << ", p99 " << timers[site].percentile(0.99) << ", max "
+                << timers[site].maxValue << "\n";
+#endif
+
+    double sum = 0, lowest = 1, highest = 0, classSum[kMaxInstanceClasses] = {}, regionSum[kMaxRegions] = {};
+    string perInstance;
+    for (auto &inst: instances) {
+        InstanceStatus view = inst.status.load();
+        double busy = view.totalTime + (view.running ? max(0.0, min((double) view.currDungeonDuration,
+                                                                     elapsed - view.runStart)) : 0.0);
+        double utilization = elapsed > 0 ? busy / elapsed : 0;
+        sum += utilization;
+        classSum[inst.instanceClass] += utilization;
+        regionSum[inst.region] += utilization;
+        lowest = min(lowest, utilization);
+        highest = max(highest, utilization);
+        perInstance += "Instance " + to_string(inst.id) + " utilization: " + to_string(utilization * 100) + "%\n";
+    }
+    if (!instances.empty())
+        out << "Instance utilization: mean " << sum / instances.size() * 100 << "%, min " << lowest * 100
+                << "%, max " << highest * 100 << "%\n";
+    if (instanceClasses.size() > 1) {
+        out << "Utilization by class:";
+        for (size_t c = 0; c < instanceClasses.size(); ++c)
+            out << (c ? ", " : " ") << instanceClasses[c].name << " "
+                    << (instanceClasses[c].count ? classSum[c] / instanceClasses[c].count * 100 : 0.0) << "%";
+        out << "\n";
+    }
+    for (int region = 0; region < regions && regions > 1; ++region) {
+        const Region &shard = regionState[region];
+        out << "Region " << region + 1 << ": " << shard.formed.load(memory_order_relaxed) << " parties formed ("
+                << shard.stolen.load(memory_order_relaxed) << " stolen), utilization "
+                << (shard.size ? regionSum[region] / shard.size * 100 : 0.0) << "%\n";
+    }
+    if (autoscaleMax > 0) {
+        int active = activeInstances.load(memory_order_relaxed);
+        double activeSeconds = autoscale.activeSeconds + active * max(0.0, elapsed - autoscale.lastAt);
+        out << "Autoscale: " << active << " in service (" << autoscaleMin << " to " << autoscaleMax << "), peak "
+                << autoscale.peak << ", mean " << (elapsed > 0 ? activeSeconds / elapsed : (double) active) << ", "
+                << autoscale.added << " added, " << fleetAtStart + (int) autoscale.added - active << " retired\n";
+    }
+    out << perInstance;
+}
+
+// --estimate: the expected outcome for the players queued at time 0 without running a backend. One party kind on
+// one uniform class in a single pool has a closed form: the pool fits min over roles of have / need parties, and
+// the makespan follows from the run-time distribution. Anything else is a Monte Carlo of whole virtual-time
+// simulations, through the configured match and select policies, stealing and autoscaling, running side by side.
+// Large pools take fewer trials, their makespan varying less.
+constexpr int kMaxEstimateTrials = 32;
+constexpr size_t kEstimateDispatches = 1 << 18; // parties dispatched over all trials, at most (bar two trials)
+// Past a wave of runs the closed form's makespan is a renewal approximation, off by about 15% / waves
+constexpr int kClosedFormWaves = 8;
+
+// Expected outcome of the time-0 pool, per instance and for the fleet
+struct Estimate {
+    int trials = 0; // 0: the closed form
+    vector<int> classOf;
+    vector<double> served, busy;
+    double left[kRoleCount] = {};
+    double parties = 0, makespan = 0, deviation = 0, work = 0;
+};
+
+// Mean and standard deviation of a distribution on lo..hi given its cdf
+template<typename Cdf>
+pair<double, double> cdfMoments(int lo, int hi, Cdf cdf) {
+    double mean = 0, squares = 0, below = cdf(lo - 1);
+    for (int x = lo; x <= hi; ++x) {
+        double at = cdf(x);
+        mean += x * (at - below);
+        squares += (double) x * x * (at - below);
+        below = at;
+    }
+    return {mean, sqrt(max(0.0, squares - mean * mean))};
+}
+
+// P parties on n instances, run times uniform on whole seconds t1..t2. Up to one wave the makespan is the largest
+// of P draws, exactly. Past it the fleet works through the pool at n / mean runs a second from a synchronized
+// start, so the last party is dispatched after about mean * ((P - n) / n + 1 - E[D^2] / (2 mean^2)) seconds
+// (the renewal function), and ends with the longest of its own run and the n - 1 runs then in flight, whose
+// remaining times follow the equilibrium residual distribution.
+inline bool closedFormEstimate(const SimulationConfig &config, RoleCounts roles, Estimate &estimate) {
+    if (config.partyKinds.size() != 1 || config.instanceClasses.size() != 1 || config.regions != 1 ||
+        config.skillBands != 1 || config.autoscaleMax > 0)
+        return false;
+    const InstanceClass &instanceClass = config.instanceClasses[0];
+    if (instanceClass.duration.shape != DurationDistribution::Uniform) return false;
+    const PartyKind &kind = config.partyKinds[0];
+    auto t1 = (int) instanceClass.duration.a, t2 = (int) instanceClass.duration.b;
+    int n = instanceClass.count;
+    int have[kRoleCount] = {roles.tanks, roles.healers, roles.dps};
+    int parties = n > 0 ? fitCount(kind, have) : 0;
+    if (parties > n && t1 < t2 && (long long) parties < (long long) kClosedFormWaves * n) return false;
+
+    double range = t2 - t1 + 1, mean = (t1 + t2) / 2.0, variance = (range * range - 1) / 12;
+    auto runCdf = [&](int x) { return x < t1 ? 0.0 : x >= t2 ? 1.0 : (x - t1 + 1) / range; };
+    if (parties <= n) {
+        tie(estimate.makespan, estimate.deviation) =
+                parties == 0 ? pair<double, double>{0, 0}
+                             : cdfMoments(t1, t2, [&](int x) { return pow(runCdf(x), parties); });
+    } else if (t1 == t2) {
+        estimate.makespan = (double) ((parties + n - 1) / n) * t1;
+    } else {
+        vector<double> residualCdf(t2 + 1); // P(remaining time <= x) for a run in flight
+        double tail = 0;
+        for (int x = 0; x <= t2; ++x) residualCdf[x] = min(1.0, (tail += 1 - runCdf(x)) / mean);
+        auto [last, lastDeviation] = cdfMoments(0, t2, [&](int x) {
+            return x < 0 ? 0.0 : runCdf(x) * pow(residualCdf[x], n - 1);
+        });
+        double waves = (double) (parties - n) / n;
+        double dispatched = mean * (waves + 1 - (variance + mean * mean) / (2 * mean * mean));
+        estimate.makespan = dispatched + last;
+        estimate.deviation = sqrt(waves * variance / n + lastDeviation * lastDeviation);
+    }
+
+    // Up to a wave the lowest-numbered instances take a party each, whatever the select policy; past it the
+    // instances are alike and share the pool evenly
+    estimate.classOf.assign(n, 0);
+    estimate.served.assign(n, 0);
+    estimate.busy.assign(n, 0);
+    for (int i = 0; i < n; ++i) {
+        estimate.served[i] = parties <= n ? i < parties : (double) parties / n;
+        estimate.busy[i] = estimate.served[i] * mean;
+    }
+    for (int role = 0; role < kRoleCount; ++role) estimate.left[role] = have[role] - parties * kind.need[role];
+    estimate.parties = parties;
+    estimate.work = parties * mean;
+    return true;
+}
+
+inline void Simulation::printEstimate(ostream &out) {
+    RoleCounts roles = loadRoles();
+    Estimate estimate;
+    if (!closedFormEstimate(*this, roles, estimate)) {
+        // Size the trials from the parties the whole pool could form
+        int unlimited[kMaxPartyKinds];
+        fill(unlimited, unlimited + kMaxPartyKinds, numeric_limits<int>::max());
+        size_t formable = 0;
+        for (int pool = 0; pool < regions * skillBands; ++pool)
+            formable += planParties(loadRoles(pool), unlimited).parties;
+        estimate.trials = (int) clamp<size_t>(kEstimateDispatches / max<size_t>(formable, 1), 2, kMaxEstimateTrials);
+
+        // Trial k runs this configuration in virtual time with seed masterSeed + k, so trial 0 is the run itself
+        SimulationConfig config = *this;
+        config.backend = Backend::Virtual;
+        config.paced = false;
+        config.quiet = true;
+        config.metricsEnabled = true; // completions stamp lastCompletion only with metrics on
+        if (autoscaleMax > 0) config.instanceClasses[0].count = fleetAtStart; // prepareSimulation grew it to the max
+        vector<double> makespans(estimate.trials);
+        vector<vector<int> > served(estimate.trials), busy(estimate.trials);
+        vector<RoleCounts> left(estimate.trials);
+        atomic<int> next{0};
+        vector<thread> workers;
+        for (int worker = 0; worker < min(estimate.trials, (int) max(1u, thread::hardware_concurrency())); ++worker) {
+            workers.emplace_back([&] {
+                for (int trial; (trial = next.fetch_add(1, memory_order_relaxed)) < estimate.trials;) {
+                    Simulation sim(config);
+                    sim.masterSeed = masterSeed + trial;
+                    string error; // the configuration was prepared once already
+                    sim.runPoint(0, roles.tanks, roles.healers, roles.dps, error);
+                    makespans[trial] = sim.lastCompletion;
+                    for (auto &inst: sim.instances) {
+                        served[trial].push_back(inst.partiesServed);
+                        busy[trial].push_back(inst.totalTime);
+                    }
+                    left[trial] = sim.loadRoles();
+                }
+            });
+        }
+        for (auto &worker: workers) worker.join();
+
+        // Fleet laid out as runSimulation does, class by class
+        for (size_t c = 0; c < instanceClasses.size(); ++c)
+            estimate.classOf.insert(estimate.classOf.end(), instanceClasses[c].count, (int) c);
+        double makespanSquares = 0;
+        estimate.served.assign(served[0].size(), 0);
+        estimate.busy.assign(served[0].size(), 0);
+        for (int trial = 0; trial < estimate.trials; ++trial) {
+            for (size_t i = 0; i < served[trial].size(); ++i) {
+                estimate.served[i] += (double) served[trial][i] / estimate.trials;
+                estimate.busy[i] += (double) busy[trial][i] / estimate.trials;
+                estimate.parties += (double) served[trial][i] / estimate.trials;
+                estimate.work += (double) busy[trial][i] / estimate.trials;
+            }
+            estimate.left[Tank] += (double) left[trial].tanks / estimate.trials;
+            estimate.left[Healer] += (double) left[trial].healers / estimate.trials;
+            estimate.left[Dps] += (double) left[trial].dps / estimate.trials;
+            estimate.makespan += makespans[trial] / estimate.trials;
+            makespanSquares += makespans[trial] * makespans[trial] / estimate.trials;
+        }
+        estimate.deviation = sqrt(max(0.0, makespanSquares - estimate.makespan * estimate.makespan));
+    }
+
+    size_t fleet = estimate.served.size();
+    if (estimate.trials > 0) out << "\n=== Estimate (" << estimate.trials << " trials) ===\n";
+    else out << "\n=== Estimate (closed form) ===\n";
+    for (size_t i = 0; i < fleet; ++i) {
+        out << "Instance " << i + 1;
+        if (instanceClasses.size() > 1) out << " (" << instanceClasses[estimate.classOf[i]].name << ")";
+        out << " served " << estimate.served[i] << " parties, total time: " << estimate.busy[i] << " seconds.\n";
+    }
+    out << "Leftover players: Tanks: " << estimate.left[Tank] << ", Healers: " << estimate.left[Healer]
+            << ", DPS: " << estimate.left[Dps] << "\n";
+    out << "Parties: " << estimate.parties << ", makespan (s): mean " << estimate.makespan << ", stddev "
+            << estimate.deviation << ", work per instance " << (fleet ? estimate.work / fleet : 0.0) << "\n";
+}
+
+// Live metrics for dashboards (--metrics-port): aggregate gauges and counters in the Prometheus text format at
+// /metrics, per-instance series only at /instances. A single thread serves one scrape at a time from the same
+// atomics, shards and status seqlocks the reports read, so scraping never blocks the simulation.
+inline void Simulation::writeExport(ostream &out) {
+    HistogramSummary waits, playerWaits;
+    uint64_t parties = 0, completed = 0;
+    {
+        lock_guard<mutex> lock(metrics.m);
+        for (auto &shard: metrics.shards) {
+            waits.add(shard->partyWaitMs);
+            playerWaits.add(shard->playerWaitMs);
+            parties += shard->partiesFormed.load(memory_order_relaxed);
+            completed += shard->runsCompleted.load(memory_order_relaxed);
+        }
+    }
+    double now = simNow();
+    int busy = busyCount.load(memory_order_relaxed), active = activeInstances.load(memory_order_relaxed);
+    RoleCounts roles = loadRoles();
+    out << "# HELP dungeon_simulated_seconds Simulated time since the run started\n"
+            << "# TYPE dungeon_simulated_seconds gauge\ndungeon_simulated_seconds " << now << "\n"
+            << "# HELP dungeon_instances Dungeon instances by state\n# TYPE dungeon_instances gauge\n"
+            << "dungeon_instances{state=\"busy\"} " << busy << "\n"
+            << "dungeon_instances{state=\"free\"} " << active - busy << "\n"
+            << "dungeon_instances{state=\"parked\"} " << (int) instances.size() - active << "\n"
+            << "# HELP dungeon_queued_players Players waiting in the pools\n# TYPE dungeon_queued_players gauge\n"
+            << "dungeon_queued_players{role=\"tank\"} " << roles.tanks << "\n"
+            << "dungeon_queued_players{role=\"healer\"} " << roles.healers << "\n"
+            << "dungeon_queued_players{role=\"dps\"} " << roles.dps << "\n"
+            << "# TYPE dungeon_parties_formed_total counter\ndungeon_parties_formed_total " << parties << "\n"
+            << "# TYPE dungeon_runs_completed_total counter\ndungeon_runs_completed_total " << completed << "\n"
+            << "# TYPE dungeon_players_rejected_total counter\ndungeon_players_rejected_total "
+            << playersRejected.load(memory_order_relaxed) << "\n"
+            << "# HELP dungeon_players_shed_total Arrivals turned away at a queue cap\n"
+            << "# TYPE dungeon_players_shed_total counter\n"
+            << "dungeon_players_shed_total{role=\"tank\"} " << playersShed[Tank].load(memory_order_relaxed) << "\n"
+            << "dungeon_players_shed_total{role=\"healer\"} " << playersShed[Healer].load(memory_order_relaxed) << "\n"
+            << "dungeon_players_shed_total{role=\"dps\"} " << playersShed[Dps].load(memory_order_relaxed) << "\n"
+            << "# TYPE dungeon_arrivals_held_total counter\ndungeon_arrivals_held_total "
+            << arrivalsHeld.load(memory_order_relaxed) << "\n"
+            << "# HELP dungeon_parties_per_second Parties formed per simulated second so far\n"
+            << "# TYPE dungeon_parties_per_second gauge\ndungeon_parties_per_second "
+            << (now > 0 ? (double) parties / now : 0.0) << "\n";
+    pair<const char *, const HistogramSummary *> histograms[] = {{"party", &waits}, {"player", &playerWaits}};
+    for (auto [name, histogram]: histograms) {
+        out << "# HELP dungeon_" << name << "_wait_seconds Simulated time queued before assignment\n"
+                << "# TYPE dungeon_" << name << "_wait_seconds summary\n";
+        for (double quantile: {0.5, 0.9, 0.99})
+            out << "dungeon_" << name << "_wait_seconds{quantile=\"" << quantile << "\"} "
+                    << histogram->percentile(quantile) / 1000.0 << "\n";
+        out << "dungeon_" << name << "_wait_seconds_sum " << histogram->sum / 1000.0 << "\n"
+                << "dungeon_" << name << "_wait_seconds_count " << histogram->total << "\n";
+    }
+}
+
+// One family at a time, as the text format requires, from a single snapshot of every instance's status
+inline void Simulation::writeInstanceExport(ostream &out) {
+    vector<InstanceStatus> views;
+    views.reserve(instances.size());
+    for (auto &inst: instances) views.push_back(inst.status.load());
+    auto family = [&](const char *name, const char *type, auto value) {
+        out << "# TYPE " << name << " " << type << "\n";
+        for (size_t i = 0; i < views.size(); ++i)
+            out << name << "{instance=\"" << instances[i].id << "\"} " << value(views[i]) << "\n";
+    };
+    family("dungeon_instance_running", "gauge", [](const InstanceStatus &view) { return (int) view.running; });
+    family("dungeon_instance_parties_served_total", "counter",
+           [](const InstanceStatus &view) { return view.partiesServed; });
+    family("dungeon_instance_busy_seconds_total", "counter", [](const InstanceStatus &view) { return view.totalTime; });
+}
+
+#if __has_include(<sys/socket.h>)
+inline void MetricsExporter::serve() {
+    while (!stopping) {
+        pollfd ready{listenFd, POLLIN, 0};
+        if (poll(&ready, 1, 200) <= 0) continue;
+        int client = accept(listenFd, nullptr, nullptr);
+        if (client < 0) continue;
+        timeval timeout{1, 0}; // a client that never sends its request does not hold up the next scrape
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        string request;
+        char buffer[1024];
+        for (ssize_t got; request.find("\r\n\r\n") == string::npos && request.size() < 8192 &&
+                          (got = recv(client, buffer, sizeof buffer, 0)) > 0;)
+            request.append(buffer, got);
+        string path = request.substr(0, request.find("\r\n"));
+        ostringstream body;
+        const char *status = "200 OK";
+        if (path.rfind("GET /metrics ", 0) == 0) sim->writeExport(body);
+        else if (path.rfind("GET /instances ", 0) == 0) sim->writeInstanceExport(body);
+        else {
+            status = "404 Not Found";
+            body << "try /metrics or /instances\n";
+        }
+        string response = string("HTTP/1.0 ") + status + "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: " + to_string(body.str().size()) + "\r\nConnection: close\r\n\r\n" +
+                          body.str();
+        for (size_t sent = 0; sent < response.size();) {
+            ssize_t wrote = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (wrote <= 0) break;
+            sent += wrote;
+        }
+        close(client);
+    }
+}
+#endif
+
+// Everything derived from the run parameters once they are final: generator streams, player queues for the
+// skill bands, kinds sorted largest first and, when no classes were declared, one class of n instances with
+// uniform [t1, t2] runs (otherwise n becomes the declared fleet size). Fails when some kind fits no class.
+inline bool Simulation::prepareSimulation(int &n, string &error) {
+    skillGen = Philox(masterSeed, kSkillStream);
+    stable_sort(partyKinds.begin(), partyKinds.end(), [](const PartyKind &a, const PartyKind &b) {
+        return a.size > b.size;
+    });
+    playerQueues = make_unique<PlayerQueue[]>(regions * skillBands * kRoleCount);
+    if (backend == Backend::Virtual && !paced) timeScale = numeric_limits<double>::infinity();
+    if ((backend == Backend::Pool || backend == Backend::Coroutine) && poolWorkers == 0)
+        poolWorkers = max(1u, thread::hardware_concurrency());
+
+    if (!instanceClasses.empty()) {
+        long long fleet = 0;
+        for (auto &instanceClass: instanceClasses) fleet += instanceClass.count;
+        if (fleet > numeric_limits<int>::max()) {
+            error = "instance classes add up to more than " + to_string(numeric_limits<int>::max()) + " instances";
+            return false;
+        }
+        n = (int) fleet;
+    } else {
+        InstanceClass standard{"standard", n, numeric_limits<int>::max(), {}};
+        standard.duration.a = t1;
+        standard.duration.b = t2;
+        instanceClasses.push_back(standard);
+    }
+    fleetAtStart = n;
+    if (autoscaleMax > 0) {
+        if (instanceClasses.size() > 1) {
+            error = "--autoscale scales a single instance class";
+            return false;
+        }
+        fleetAtStart = clamp(n, autoscaleMin, autoscaleMax);
+        instanceClasses[0].count = n = autoscaleMax;
+    }
+    if (fleetAtStart > 0 && regions > fleetAtStart) {
+        error = "--regions needs at least one instance per region";
+        return false;
+    }
+    // Instance i goes to region i % regions, so each region gets its share of every class
+    auto inRegion = [this](long long end, int region) { return end > region ? (end - region - 1) / regions + 1 : 0; };
+    for (int region = 0; region < regions; ++region) {
+        FreeInstances all{*this};
+        long long start = 0;
+        for (size_t c = 0; c < instanceClasses.size(); ++c) {
+            long long end = start + instanceClasses[c].count;
+            all.perClass[c] = (int) (inRegion(end, region) - inRegion(start, region));
+            start = end;
+        }
+        for (auto &kind: partyKinds) {
+            if (all.fitting(kind) == 0) {
+                error = "no instance class" + (regions > 1 ? " in region " + to_string(region + 1) : "") +
+                        " is big enough for " + kind.name + " parties (" + to_string(kind.size) + " players)";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Build the fleet and run the configured backend to completion, with the monitor loop on the calling thread,
+// then flush the log and the event trace. Players present at time 0 must already be queued.
+inline void Simulation::runSimulation() {
+    logSink.start(logCapacity);
+
+    // Lay out the fleet class by class, then start threads
+    size_t fleet = 0;
+    for (auto &instanceClass: instanceClasses) fleet += instanceClass.count;
+    instances.allocate(fleet);
+    poolReady.allocate(fleet);
+    int index = 0;
+    for (size_t c = 0; c < instanceClasses.size(); ++c) {
+        for (int i = 0; i < instanceClasses[c].count; ++i, ++index) {
+            instances[index].init(index, (int) c, index % regions, masterSeed);
+            if (index < fleetAtStart) regionState[index % regions].size++;
+        }
+    }
+    for (int region = 0; region < regions; ++region) regionState[region].parked.reserve(fleet / regions + 1);
+    for (int i = (int) fleet - 1; i >= fleetAtStart; --i) regionState[i % regions].parked.push_back(i);
+    activeInstances = fleetAtStart;
+    autoscale.peak = fleetAtStart;
+    if (backend == Backend::Threads)
+        for (auto &inst: instances)
+            instanceThreads.emplace_back(&Simulation::instanceThread, this, &inst);
+    // Timer ticks of a millisecond, finer when a simulated second passes in less than 16 ms
+    poolTimers.tickNs = clamp<int64_t>((int64_t) (1e9 / timeScale / 16), 1000, 1000000);
+    if (backend == Backend::Coroutine)
+        for (auto &inst: instances)
+            inst.lifecycle = instanceLifecycle(&inst).handle;
+    for (int i = 0; i < poolWorkers && (backend == Backend::Pool || backend == Backend::Coroutine); ++i)
+        poolThreads.emplace_back(&Simulation::poolWorkerThread, this);
+    exporter.start();
+
+    // Start scheduler and, for streaming runs, the arrival producer
+    arrivalsOpen = arrivals.configured();
+    arrivals.start(masterSeed);
+    // Not re-armed once interrupted, so in a process that runs several simulations a second Ctrl-C still aborts
+    if (!interruptRequested) {
+        signal(SIGINT, [](int) {
+            interruptRequested = 1;
+            signal(SIGINT, SIG_DFL); // a second Ctrl-C aborts instead of draining
+        });
+    }
+    wallStart = chrono::steady_clock::now();
+    thread scheduler(schedulerFor(matchPolicy, selectPolicy), this);
+    thread producer;
+    if (arrivalsOpen && backend != Backend::Virtual) producer = thread(&Simulation::arrivalThread, this);
+
+#ifdef SIGUSR1
+    if (metricsEnabled) signal(SIGUSR1, [](int) { metricsRequested = true; });
+#endif
+
+    // Monitor loop (display status every second); an unpaced virtual run has no wall-clock cadence to show. The
+    // status text is rebuilt in one buffer reserved for the whole fleet.
+    string status;
+    if (!quiet) status.reserve(64 + (statusSummary ? 64 : instances.size() * 48));
+    while (!stopFlag && (backend != Backend::Virtual || paced)) {
+        if (interruptRequested && !draining && backend != Backend::Virtual) beginDrain();
+        if (autoscaleMax > 0 && backend != Backend::Virtual) autoscaleStep(simNow()); // once a wall second
+        if (metricsRequested.exchange(false)) {
+            ostringstream report;
+            printMetrics(report, simNow());
+            writeLog(report.str());
+        }
+        if (!quiet) {
+            status = "\n[Status]\n";
+            if (statusSummary) {
+                status += "Instances active: ";
+                appendNumber(status, busyCount.load(memory_order_relaxed));
+                status += "/";
+                appendNumber(status, (long long) instances.size());
+                status += "\n";
+            } else {
+                for (auto &inst: instances) {
+                    InstanceStatus view = inst.status.load();
+                    status += "Instance ";
+                    appendNumber(status, inst.id);
+                    if (view.running) {
+                        status += ": active (";
+                        appendNumber(status, elapsedSeconds(view));
+                        status += "/";
+                        appendNumber(status, view.currDungeonDuration);
+                        status += ")\n";
+                    } else {
+                        status += ": empty\n";
+                    }
+                }
+            }
+            RoleCounts roles = loadRoles(); // one atomic word per band
+            status += "Leftover players: Tanks: ";
+            appendNumber(status, roles.tanks);
+            status += ", Healers: ";
+            appendNumber(status, roles.healers);
+            status += ", DPS: ";
+            appendNumber(status, roles.dps);
+            status += "\n";
+            writeLog(status);
+        }
+        this_thread::sleep_for(chrono::milliseconds(1000));
+    }
+
+    scheduler.join();
+    if (producer.joinable()) producer.join();
+    for (auto &worker: instanceThreads)
+        worker.join();
+    for (auto &worker: poolThreads)
+        worker.join();
+    exporter.stop();
+    logSink.stop();
+    traceRecorder.close();
+}
+
+// One run of a batch tool (the sweep, the benchmark): a fleet of n instances with the given players queued at
+// time 0, run to completion on the configured backend. Returns the run's wall seconds, or -1 with error set when
+// prepareSimulation rejects the parameters.
+inline double Simulation::runPoint(int n, int tanks, int healers, int dps, string &error) {
+    if (!prepareSimulation(n, error)) return -1;
+    if (tanks > 0) addPlayers(Tank, tanks, 0);
+    if (healers > 0) addPlayers(Healer, healers, 0);
+    if (dps > 0) addPlayers(Dps, dps, 0);
+
+    int64_t start = wallNanos();
+    runSimulation();
+    return (wallNanos() - start) / 1e9;
+}
+
+// Comma-separated integers from minimum up, for the batch tools' list flags
+inline bool parseList(const string &text, vector<int> &out, int minimum) {
+    out.clear();
+    istringstream items(text);
+    for (string item; getline(items, item, ',');) {
+        char *end = nullptr;
+        long value = strtol(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || value < minimum || value > numeric_limits<int>::max()) return false;
+        out.push_back((int) value);
+    }
+    return !out.empty();
+}
+
+#endif //STDISCM_P2_SIMULATOR_H
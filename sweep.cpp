@@ -0,0 +1,193 @@
+#include "simulator.h"
+
+// Parameter sweep for capacity planning: runs the virtual-time simulation over the grid of instance, role and
+// dungeon time values and prints one CSV row (or JSON object per line) per run, in grid order. Each point runs as
+// a Simulation of its own, up to --jobs of them at once on a pool of threads.
+
+struct SweepPoint {
+    int instances, tanks, healers, dps, t1, t2, repeat;
+};
+
+// Run one point to completion and format its row; empty with error set if the point was rejected
+string sweepPoint(const SimulationConfig &config, const SweepPoint &point, uint64_t seed, bool json, string &error) {
+    Simulation sim(config); // no classes configured, so prepareSimulation makes the default one for this fleet
+    sim.t1 = point.t1;
+    sim.t2 = point.t2;
+    // The same repeat shares a seed across the grid, so points compare on equal draws
+    sim.masterSeed = seed + point.repeat;
+    double wallSeconds = sim.runPoint(point.instances, point.tanks, point.healers, point.dps, error);
+    if (wallSeconds < 0) return "";
+
+    HistogramSummary waits, playerWaits;
+    uint64_t formed = 0;
+    {
+        lock_guard<mutex> lock(sim.metrics.m);
+        for (auto &shard: sim.metrics.shards) {
+            waits.add(shard->partyWaitMs);
+            playerWaits.add(shard->playerWaitMs);
+            formed += shard->partiesFormed.load(memory_order_relaxed);
+        }
+    }
+    double elapsed = sim.lastCompletion;
+    double utilization = 0;
+    for (auto &inst: sim.instances) utilization += elapsed > 0 ? inst.totalTime / elapsed : 0;
+    if (!sim.instances.empty()) utilization /= sim.instances.size();
+    RoleCounts roles = sim.loadRoles();
+    double rate = elapsed > 0 ? formed / elapsed : 0;
+
+    ostringstream row;
+    if (json) {
+        row << "{\"instances\": " << point.instances << ", \"tanks\": " << point.tanks << ", \"healers\": "
+                << point.healers << ", \"dps\": " << point.dps << ", \"t1\": " << point.t1 << ", \"t2\": " << point.t2
+                << ", \"repeat\": " << point.repeat << ", \"seed\": " << sim.masterSeed << ", \"match\": \""
+                << sim.matchPolicy << "\", \"select\": \"" << sim.selectPolicy << "\", \"parties_formed\": " << formed
+                << ", \"sim_s\": " << elapsed << ", \"parties_per_sim_s\": " << rate
+                << ", \"party_wait_p50_s\": " << waits.percentile(0.5) / 1000.0
+                << ", \"party_wait_p99_s\": " << waits.percentile(0.99) / 1000.0
+                << ", \"player_wait_p50_s\": " << playerWaits.percentile(0.5) / 1000.0
+                << ", \"player_wait_p99_s\": " << playerWaits.percentile(0.99) / 1000.0
+                << ", \"utilization\": " << utilization << ", \"leftover_tanks\": " << roles.tanks
+                << ", \"leftover_healers\": " << roles.healers << ", \"leftover_dps\": " << roles.dps
+                << ", \"wall_s\": " << wallSeconds << "}\n";
+        return row.str();
+    }
+    row << point.instances << "," << point.tanks << "," << point.healers << "," << point.dps << "," << point.t1
+            << "," << point.t2 << "," << point.repeat << "," << sim.masterSeed << "," << sim.matchPolicy << ","
+            << sim.selectPolicy << "," << formed << "," << elapsed << "," << rate << ","
+            << waits.percentile(0.5) / 1000.0 << "," << waits.percentile(0.99) / 1000.0 << ","
+            << playerWaits.percentile(0.5) / 1000.0 << "," << playerWaits.percentile(0.99) / 1000.0 << ","
+            << utilization << "," << roles.tanks << "," << roles.healers << "," << roles.dps << "," << wallSeconds
+            << "\n";
+    return row.str();
+}
+
+// Run every point on up to jobs threads, printing rows in grid order as the prefix completes; false if any failed.
+// Ctrl-C stops the sweep: no new points start, and the points it drained are reported rather than printed.
+bool runSweep(const SimulationConfig &config, const vector<SweepPoint> &points, uint64_t seed, bool json, int jobs) {
+    vector<string> rows(points.size()), errors(points.size());
+    vector<bool> done(points.size());
+    size_t running = min((size_t) jobs, points.size()); // workers still taking points
+    mutex m; // guards rows, errors, done and running
+    condition_variable cv_done;
+    atomic<size_t> next{0};
+
+    vector<thread> workers;
+    for (size_t worker = 0; worker < running; ++worker) {
+        workers.emplace_back([&] {
+            for (size_t i; !interruptRequested && (i = next.fetch_add(1, memory_order_relaxed)) < points.size();) {
+                string error;
+                string row = sweepPoint(config, points[i], seed, json, error);
+                if (interruptRequested) {
+                    row.clear();
+                    error = "interrupted";
+                }
+                lock_guard<mutex> lock(m);
+                rows[i] = move(row);
+                errors[i] = move(error);
+                done[i] = true;
+                cv_done.notify_one();
+            }
+            lock_guard<mutex> lock(m);
+            running--;
+            cv_done.notify_one();
+        });
+    }
+
+    bool ok = true;
+    for (size_t printed = 0; printed < points.size(); ++printed) {
+        unique_lock<mutex> lock(m);
+        cv_done.wait(lock, [&] { return done[printed] || running == 0; });
+        if (!done[printed]) {
+            cerr << "sweep interrupted: " << points.size() - printed << " of " << points.size()
+                    << " points not run\n";
+            ok = false;
+            break;
+        }
+        if (rows[printed].empty()) {
+            const SweepPoint &point = points[printed];
+            cerr << "point instances=" << point.instances << " tanks=" << point.tanks << " healers=" << point.healers
+                    << " dps=" << point.dps << " t1=" << point.t1 << " t2=" << point.t2 << " repeat=" << point.repeat
+                    << " failed: " << errors[printed] << "\n";
+            ok = false;
+        }
+        cout << rows[printed];
+        cout.flush();
+    }
+    for (auto &worker: workers) worker.join();
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    vector<int> fleetSizes = {10}, tankCounts = {100}, healerCounts = {100}, dpsCounts = {300};
+    vector<int> minTimes = {1}, maxTimes = {15};
+    int repeats = 1;
+    int jobs = (int) max(1u, thread::hardware_concurrency());
+    uint64_t seed = 1;
+    bool json = false;
+    SimulationConfig config;
+
+    vector<string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        bool ok = true;
+        if (arg == "--instances" && hasValue) ok = parseList(args[++i], fleetSizes, 1);
+        else if (arg == "--tanks" && hasValue) ok = parseList(args[++i], tankCounts, 0);
+        else if (arg == "--healers" && hasValue) ok = parseList(args[++i], healerCounts, 0);
+        else if (arg == "--dps" && hasValue) ok = parseList(args[++i], dpsCounts, 0);
+        else if (arg == "--t1" && hasValue) ok = parseList(args[++i], minTimes, 0);
+        else if (arg == "--t2" && hasValue) ok = parseList(args[++i], maxTimes, 0);
+        else if (arg == "--repeat" && hasValue) ok = (repeats = atoi(args[++i].c_str())) > 0;
+        else if (arg == "--jobs" && hasValue) ok = (jobs = atoi(args[++i].c_str())) > 0;
+        else if (arg == "--seed" && hasValue) {
+            char *end = nullptr;
+            seed = strtoull(args[++i].c_str(), &end, 10);
+            ok = !args[i].empty() && *end == '\0';
+        }
+        else if (arg == "--format" && hasValue && (args[i + 1] == "csv" || args[i + 1] == "json"))
+            json = args[++i] == "json";
+        else if (arg == "--match" && hasValue &&
+                 (args[i + 1] == "fifo" || args[i + 1] == "lwf" || args[i + 1] == "skill"))
+            config.matchPolicy = args[++i];
+        else if (arg == "--select" && hasValue &&
+                 (args[i + 1] == "first" || args[i + 1] == "round-robin" || args[i + 1] == "least-used"))
+            config.selectPolicy = args[++i];
+        else ok = false;
+        if (!ok) {
+            cerr << "Usage: " << argv[0] << " [--instances N,N,...] [--tanks N,N,...] [--healers N,N,...]\n"
+                    << "       [--dps N,N,...] [--t1 N,N,...] [--t2 N,N,...] [--repeat R] [--jobs J] [--seed S]\n"
+                    << "       [--format csv|json] [--match fifo|lwf|skill] [--select first|round-robin|least-used]\n"
+                    << "Runs every combination in virtual time; points with t1 > t2 are skipped.\n";
+            return 1;
+        }
+    }
+    for (auto *counts: {&tankCounts, &healerCounts, &dpsCounts}) {
+        for (int count: *counts) {
+            if (count > kMaxRoleCount) {
+                cerr << "player counts are limited to " << kMaxRoleCount << " per role\n";
+                return 1;
+            }
+        }
+    }
+
+    config.backend = Backend::Virtual;
+    config.quiet = true;
+    config.metricsEnabled = true;
+    config.skillBands = config.matchPolicy == "fifo" ? 1 : 4;
+
+    vector<SweepPoint> points;
+    for (int fleet: fleetSizes)
+        for (int tanks: tankCounts)
+            for (int healers: healerCounts)
+                for (int dps: dpsCounts)
+                    for (int low: minTimes)
+                        for (int high: maxTimes)
+                            for (int repeat = 0; repeat < repeats && low <= high; ++repeat)
+                                points.push_back({fleet, tanks, healers, dps, low, high, repeat});
+
+    if (!json)
+        cout << "instances,tanks,healers,dps,t1,t2,repeat,seed,match,select,parties_formed,sim_s,parties_per_sim_s,"
+                "party_wait_p50_s,party_wait_p99_s,player_wait_p50_s,player_wait_p99_s,utilization,leftover_tanks,"
+                "leftover_healers,leftover_dps,wall_s\n";
+    return runSweep(config, points, seed, json, jobs) ? 0 : 1;
+}